@@ -0,0 +1,377 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "Poco/DateTimeFormatter.h"
+#include "Poco/Event.h"
+#include "Poco/Logger.h"
+#include "Poco/Message.h"
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+#include "Poco/Timespan.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Util/AbstractConfiguration.h"
+#include "Poco/Util/Application.h"
+#include "Poco/Util/Subsystem.h"
+
+#include "spsc_ring.h"
+#include "thread_placement.h"
+
+struct AsyncLogSettings
+{
+    bool enabled = true;
+    // Records buffered per logging thread before new ones are dropped.
+    size_t capacity = 1024;
+
+    static AsyncLogSettings fromConfig(const Poco::Util::AbstractConfiguration &config)
+    {
+        AsyncLogSettings settings;
+        settings.enabled = config.getBool("async_log.enable", settings.enabled);
+        settings.capacity = std::max(2, config.getInt("async_log.capacity", static_cast<int>(settings.capacity)));
+        return settings;
+    }
+};
+
+// How a log argument is captured on the calling thread and formatted later.
+// Arithmetic values and Timespans are copied as-is; strings are copied with a
+// 32-bit length prefix and truncated to the space left in the record.
+template <typename T, typename = void> struct LogArg;
+
+template <typename T> struct LogArg<T, std::enable_if_t<std::is_arithmetic_v<T>>>
+{
+    static constexpr size_t kFixedBytes = sizeof(T);
+
+    static size_t capture(unsigned char *to, size_t, T value)
+    {
+        std::memcpy(to, &value, sizeof(value));
+        return sizeof(value);
+    }
+
+    static size_t format(const unsigned char *from, std::string &out)
+    {
+        T value;
+        std::memcpy(&value, from, sizeof(value));
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            out += value ? "true" : "false";
+        }
+        else if constexpr (std::is_same_v<T, char>)
+        {
+            out += value;
+        }
+        else
+        {
+            char text[64];
+            const std::to_chars_result result = std::to_chars(text, text + sizeof(text), value);
+            out.append(text, result.ptr);
+        }
+        return sizeof(value);
+    }
+};
+
+template <> struct LogArg<std::string_view>
+{
+    static constexpr size_t kFixedBytes = sizeof(uint32_t);
+
+    static size_t capture(unsigned char *to, size_t room, std::string_view text)
+    {
+        const uint32_t size = static_cast<uint32_t>(std::min(text.size(), room - sizeof(uint32_t)));
+        std::memcpy(to, &size, sizeof(size));
+        std::memcpy(to + sizeof(size), text.data(), size);
+        return sizeof(size) + size;
+    }
+
+    static size_t format(const unsigned char *from, std::string &out)
+    {
+        uint32_t size;
+        std::memcpy(&size, from, sizeof(size));
+        out.append(reinterpret_cast<const char *>(from + sizeof(size)), size);
+        return sizeof(size) + size;
+    }
+};
+
+template <> struct LogArg<std::string> : LogArg<std::string_view>
+{
+};
+
+template <> struct LogArg<const char *> : LogArg<std::string_view>
+{
+};
+
+template <> struct LogArg<char *> : LogArg<std::string_view>
+{
+};
+
+// Formatted with DateTimeFormatter on the logging thread.
+template <> struct LogArg<Poco::Timespan>
+{
+    static constexpr size_t kFixedBytes = sizeof(Poco::Timespan::TimeDiff);
+
+    static size_t capture(unsigned char *to, size_t, const Poco::Timespan &span)
+    {
+        const Poco::Timespan::TimeDiff micros = span.totalMicroseconds();
+        std::memcpy(to, &micros, sizeof(micros));
+        return sizeof(micros);
+    }
+
+    static size_t format(const unsigned char *from, std::string &out)
+    {
+        Poco::Timespan::TimeDiff micros;
+        std::memcpy(&micros, from, sizeof(micros));
+        out += Poco::DateTimeFormatter::format(Poco::Timespan(micros));
+        return sizeof(micros);
+    }
+};
+
+template <typename T> using LogArgOf = LogArg<std::decay_t<T>>;
+
+// Logging front end for hot paths. A call checks the level, copies its
+// arguments into a record in the calling thread's own SPSC ring and returns;
+// a background thread formats records by concatenating the arguments and
+// hands them to the application logger, whose channel does the writing. A
+// full ring drops the record and counts it rather than block the caller.
+//
+// Records keep their capture time and thread id, but lines from different
+// threads are written in drain order, not strictly by time.
+class AsyncLogger : public Poco::Util::Subsystem, public Poco::Runnable
+{
+  public:
+    static constexpr size_t kArgBytes = 192;
+    static constexpr size_t kMaxThreads = 64;
+
+    AsyncLogger() : m_logger(nullptr), m_thread("async-log")
+    {
+    }
+
+    const char *name() const override
+    {
+        return "AsyncLogger";
+    }
+
+    void initialize(Poco::Util::Application &app) override
+    {
+        m_settings = AsyncLogSettings::fromConfig(app.config());
+        m_logger = &app.logger();
+        if (m_settings.enabled)
+        {
+            m_stopped = false;
+            m_running.store(true, std::memory_order_release);
+            m_thread.start(*this);
+        }
+    }
+
+    void uninitialize() override
+    {
+        if (m_running.exchange(false))
+        {
+            m_stopped = true;
+            m_wakeup.set();
+            m_thread.join();
+        }
+        if (m_logger && dropped() != 0)
+        {
+            m_logger->warning("async log dropped " + std::to_string(dropped()) + " records");
+        }
+    }
+
+    template <typename... Args> void information(Args &&...args)
+    {
+        log(Poco::Message::PRIO_INFORMATION, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args> void notice(Args &&...args)
+    {
+        log(Poco::Message::PRIO_NOTICE, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args> void warning(Args &&...args)
+    {
+        log(Poco::Message::PRIO_WARNING, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args> void error(Args &&...args)
+    {
+        log(Poco::Message::PRIO_ERROR, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args> void debug(Args &&...args)
+    {
+        log(Poco::Message::PRIO_DEBUG, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args> void log(Poco::Message::Priority priority, Args &&...args)
+    {
+        static_assert((LogArgOf<Args>::kFixedBytes + ... + 0) <= kArgBytes, "too many log arguments");
+
+        Poco::Logger *logger = m_logger;
+        if (logger == nullptr || !logger->is(priority))
+        {
+            return;
+        }
+
+        Ring *ring = m_running.load(std::memory_order_acquire) ? threadRing() : nullptr;
+        if (ring == nullptr)
+        {
+            // Not started, stopped, or too many threads: log synchronously.
+            unsigned char captured[kArgBytes];
+            capture(captured, args...);
+            std::string line;
+            formatArgs<std::decay_t<Args>...>(captured, line);
+            logger->log(Poco::Message(logger->name(), line, priority));
+            return;
+        }
+
+        const bool pushed = ring->tryPush([&](Record &record) {
+            record.priority = priority;
+            record.time = Poco::Timestamp().epochMicroseconds();
+            record.tid = Poco::Thread::currentTid();
+            record.format = &formatArgs<std::decay_t<Args>...>;
+            capture(record.args, args...);
+        });
+        if (!pushed)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        // Only wake the writer if it went to sleep with every ring empty.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleeping.load(std::memory_order_relaxed))
+        {
+            m_sleeping.store(false, std::memory_order_relaxed);
+            m_wakeup.set();
+        }
+    }
+
+    uint64_t dropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+    void run() override
+    {
+        ThreadPlacement::apply();
+        std::string line;
+        while (!m_stopped.load(std::memory_order_relaxed))
+        {
+            if (writeAvailable(line) == 0)
+            {
+                m_sleeping.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (allEmpty() && !m_stopped.load(std::memory_order_relaxed))
+                {
+                    m_wakeup.wait();
+                }
+                m_sleeping.store(false, std::memory_order_relaxed);
+            }
+        }
+        writeAvailable(line);
+    }
+
+  private:
+    struct Record
+    {
+        Poco::Message::Priority priority;
+        Poco::Timestamp::TimeVal time;
+        long tid;
+        void (*format)(const unsigned char *args, std::string &out);
+        unsigned char args[kArgBytes];
+    };
+
+    using Ring = SpscRing<Record>;
+
+    template <typename... Args> static void formatArgs(const unsigned char *args, std::string &out)
+    {
+        ((args += LogArg<Args>::format(args, out)), ...);
+    }
+
+    template <typename... Args> static void capture(unsigned char *to, const Args &...args)
+    {
+        // Strings may only use what the fixed-size arguments after them leave.
+        size_t used = 0;
+        size_t reserved = (LogArgOf<Args>::kFixedBytes + ... + 0);
+        (
+            [&](const auto &arg) {
+                using Arg = LogArgOf<decltype(arg)>;
+                reserved -= Arg::kFixedBytes;
+                used += Arg::capture(to + used, kArgBytes - used - reserved, arg);
+            }(args),
+            ...);
+    }
+
+    // Returns this thread's ring, registering one on first use.
+    Ring *threadRing()
+    {
+        thread_local const AsyncLogger *owner = nullptr;
+        thread_local Ring *ring = nullptr;
+        if (owner == this)
+        {
+            return ring;
+        }
+
+        std::lock_guard<std::mutex> lock(m_registerMutex);
+        const size_t count = m_ringCount.load(std::memory_order_relaxed);
+        owner = this;
+        ring = nullptr;
+        if (count < kMaxThreads)
+        {
+            m_rings[count].reset(new Ring(m_settings.capacity));
+            ring = m_rings[count].get();
+            m_ringCount.store(count + 1, std::memory_order_release);
+        }
+        return ring;
+    }
+
+    size_t writeAvailable(std::string &line)
+    {
+        size_t written = 0;
+        const size_t count = m_ringCount.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; ++i)
+        {
+            written += m_rings[i]->drain([&](const Record &record) {
+                line.clear();
+                record.format(record.args, line);
+                Poco::Message message(m_logger->name(), line, record.priority);
+                message.setTime(Poco::Timestamp(record.time));
+                message.setTid(record.tid);
+                m_logger->log(message);
+            });
+        }
+        return written;
+    }
+
+    bool allEmpty() const
+    {
+        const size_t count = m_ringCount.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!m_rings[i]->empty())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    AsyncLogSettings m_settings;
+    Poco::Logger *m_logger;
+    std::array<std::unique_ptr<Ring>, kMaxThreads> m_rings;
+    std::atomic<size_t> m_ringCount{0};
+    std::mutex m_registerMutex;
+    std::atomic<uint64_t> m_dropped{0};
+    std::atomic<bool> m_running{false};
+    std::atomic<bool> m_sleeping{false};
+    std::atomic<bool> m_stopped{false};
+    Poco::Event m_wakeup;
+    Poco::Thread m_thread;
+};
@@ -0,0 +1,541 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <flatbuffers/flatbuffers.h>
+#include <zmq.hpp>
+
+#include "broker_metrics.h"
+#include "flatbuffer_frame.h"
+#include "monster_batch.h"
+#include "monster_generated.h"
+#include "payload_compression.h"
+#include "zmq_forwarder.h"
+
+// Broker throughput and latency benchmark. Publishers and subscribers run in
+// this process and talk through an XSUB/XPUB broker: either one embedded here
+// (the ZmqProxy forwarder or libzmq's zmq_proxy) or an external pocoex on its
+// configured ports. Every combination of the listed parameters is run and
+// reported as one JSON object per line.
+//
+//   pocoex_bench [key=value ...]
+//
+//   engine=forwarder,proxy       forwarder, proxy or external
+//   transport=tcp,ipc,inproc     ignored for engine=external (tcp)
+//   sizes=64,1024,16384          payload bytes
+//   payload=raw                  raw or monster: a Monster FlatBuffer with a
+//                                `size`-byte inventory, sent zero-copy and
+//                                read in place by the subscribers; or batch:
+//                                such Monsters packed into MonsterBatches
+//   batch=64                     Monsters per batch for payload=batch
+//   topics=1,64                  distinct topics, published round-robin
+//   subscribers=1,4              subscribers, each subscribed to every topic
+//   messages=200000              messages published per run
+//   rate=0                       messages per second, 0 for as fast as possible
+//   frontend=tcp://127.0.0.1:5555 backend=tcp://127.0.0.1:5556
+//                                broker ports for engine=external
+//   compressed=0                 1 if the external broker compresses the
+//                                bench/ topics (compress.enable)
+//
+// Latency is measured from the publisher's send to the subscriber's receive
+// with a timestamp in the first eight payload bytes; it is only meaningful
+// with a rate below saturation, otherwise it measures queueing. With
+// payload=batch, messages and rates count Monsters, not frames, and latency
+// runs from the send of the batch. With compressed=1 every message is
+// decompressed before anything in it is read, the timestamp included;
+// bytes_per_sec counts what a subscriber received, compressed or not.
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::vector<std::string> engines{"forwarder", "proxy"};
+    std::vector<std::string> transports{"tcp", "ipc", "inproc"};
+    std::vector<size_t> sizes{64, 1024, 16384};
+    std::vector<std::string> payloads{"raw"};
+    std::vector<size_t> topics{1, 64};
+    std::vector<size_t> subscribers{1, 4};
+    uint64_t messages = 200000;
+    uint64_t rate = 0;
+    size_t batch = 64;
+    std::string frontend = "tcp://127.0.0.1:5555";
+    std::string backend = "tcp://127.0.0.1:5556";
+    bool compressed = false;
+};
+
+struct Run
+{
+    std::string engine;
+    std::string transport;
+    size_t size;
+    std::string payload;
+    size_t topics;
+    size_t subscribers;
+};
+
+struct Endpoints
+{
+    std::string frontend;
+    std::string backend;
+};
+
+std::vector<std::string> split(const std::string &list)
+{
+    std::vector<std::string> items;
+    std::istringstream in(list);
+    for (std::string item; std::getline(in, item, ',');)
+    {
+        if (!item.empty())
+        {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+std::vector<size_t> splitNumbers(const std::string &list)
+{
+    std::vector<size_t> numbers;
+    for (const std::string &item : split(list))
+    {
+        numbers.push_back(std::strtoull(item.c_str(), nullptr, 10));
+    }
+    return numbers;
+}
+
+Options parseOptions(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const size_t eq = arg.find('=');
+        const std::string key = arg.substr(0, eq);
+        const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (key == "engine")
+        {
+            options.engines = split(value);
+        }
+        else if (key == "transport")
+        {
+            options.transports = split(value);
+        }
+        else if (key == "sizes")
+        {
+            options.sizes = splitNumbers(value);
+        }
+        else if (key == "payload")
+        {
+            options.payloads = split(value);
+        }
+        else if (key == "topics")
+        {
+            options.topics = splitNumbers(value);
+        }
+        else if (key == "subscribers")
+        {
+            options.subscribers = splitNumbers(value);
+        }
+        else if (key == "messages")
+        {
+            options.messages = std::strtoull(value.c_str(), nullptr, 10);
+        }
+        else if (key == "rate")
+        {
+            options.rate = std::strtoull(value.c_str(), nullptr, 10);
+        }
+        else if (key == "batch")
+        {
+            options.batch = std::max<size_t>(1, std::strtoull(value.c_str(), nullptr, 10));
+        }
+        else if (key == "frontend")
+        {
+            options.frontend = value;
+        }
+        else if (key == "backend")
+        {
+            options.backend = value;
+        }
+        else if (key == "compressed")
+        {
+            options.compressed = value == "1";
+        }
+        else
+        {
+            std::cerr << "unknown option: " << arg << std::endl;
+            std::exit(64);
+        }
+    }
+    return options;
+}
+
+Endpoints endpointsFor(const Run &run, const Options &options)
+{
+    if (run.engine == "external")
+    {
+        return {options.frontend, options.backend};
+    }
+    if (run.transport == "inproc")
+    {
+        return {"inproc://bench-xsub", "inproc://bench-xpub"};
+    }
+    if (run.transport == "ipc")
+    {
+        return {"ipc:///tmp/pocoex-bench-xsub", "ipc:///tmp/pocoex-bench-xpub"};
+    }
+    return {"tcp://127.0.0.1:15555", "tcp://127.0.0.1:15556"};
+}
+
+void runBroker(zmq::context_t &context, const Endpoints &endpoints, const std::string &engine,
+               std::atomic<bool> &bound)
+{
+    zmq::socket_t xsub(context, ZMQ_XSUB);
+    zmq::socket_t xpub(context, ZMQ_XPUB);
+    xsub.set(zmq::sockopt::linger, 0);
+    xpub.set(zmq::sockopt::linger, 0);
+    xpub.set(zmq::sockopt::xpub_nodrop, 1);
+    xsub.bind(endpoints.frontend);
+    xpub.bind(endpoints.backend);
+    bound = true;
+
+    try
+    {
+        if (engine == "proxy")
+        {
+            zmq::proxy(xsub, xpub);
+        }
+        else
+        {
+            ZmqProxy forwarder(xsub, xpub);
+            for (;;)
+            {
+                forwarder.poll();
+            }
+        }
+    }
+    catch (const zmq::error_t &e)
+    {
+        if (e.num() != ETERM)
+        {
+            std::cerr << "broker: " << e.what() << std::endl;
+        }
+    }
+}
+
+struct SubscriberResult
+{
+    // Messages, or Monsters for batches.
+    uint64_t received = 0;
+    // Monster payloads that failed verification.
+    uint64_t invalid = 0;
+    // All frames as they arrived, topic and timestamp included.
+    uint64_t bytes = 0;
+    Clock::time_point first;
+    Clock::time_point last;
+    LatencyHistogram latency;
+};
+
+// `compressed`: every message has been through the broker's compressor.
+void runSubscriber(zmq::context_t &context, const Endpoints &endpoints, uint64_t expected, bool compressed,
+                   std::atomic<size_t> &ready, SubscriberResult &result)
+{
+    zmq::socket_t sub(context, ZMQ_SUB);
+    sub.set(zmq::sockopt::linger, 0);
+    sub.set(zmq::sockopt::subscribe, "bench/");
+    sub.connect(endpoints.backend);
+
+    Multipart message;
+    bool warm = false;
+    while (result.received < expected)
+    {
+        if (!message.recv(sub))
+        {
+            break;
+        }
+        if (message.front().to_string_view() == "bench/warmup")
+        {
+            if (!warm)
+            {
+                // A lossy external broker may never deliver everything; once
+                // the stream has started, give up after it has been quiet.
+                warm = true;
+                sub.set(zmq::sockopt::rcvtimeo, 2000);
+                ++ready;
+            }
+            continue;
+        }
+
+        const Clock::time_point now = Clock::now();
+        if (result.received == 0)
+        {
+            result.first = now;
+        }
+        result.last = now;
+        result.bytes += message.bytes();
+
+        // The broker compresses any payload frame, the timestamp's included.
+        if (compressed && !decompressMessage(message))
+        {
+            ++result.invalid;
+            ++result.received;
+            continue;
+        }
+
+        if (message.size() > 1 && message[1].size() >= sizeof(int64_t))
+        {
+            int64_t sent;
+            std::memcpy(&sent, message[1].data(), sizeof(sent));
+            result.latency.record(static_cast<uint64_t>(now.time_since_epoch().count() - sent));
+        }
+        uint64_t count = 1;
+        if (message.size() > 2 && isMonsterBatch(message[2]))
+        {
+            MonsterBatchView batch(message[2]);
+            if (!batch)
+            {
+                ++result.invalid;
+            }
+            for (const MyGame::Monster *monster : batch)
+            {
+                if (!monster->inventory())
+                {
+                    ++result.invalid;
+                }
+            }
+            count = std::max<uint64_t>(1, batch.size());
+        }
+        else if (message.size() > 2)
+        {
+            FlatBufferView<MyGame::Monster> monster(message[2]);
+            if (!monster || !monster->inventory())
+            {
+                ++result.invalid;
+            }
+        }
+        result.received += count;
+    }
+}
+
+void runPublisher(zmq::context_t &context, const Endpoints &endpoints, const Run &run, const Options &options,
+                  std::atomic<size_t> &ready)
+{
+    zmq::socket_t pub(context, ZMQ_PUB);
+    pub.set(zmq::sockopt::linger, 0);
+    pub.set(zmq::sockopt::xpub_nodrop, 1);
+    pub.connect(endpoints.frontend);
+
+    std::vector<std::string> topics;
+    for (size_t i = 0; i < run.topics; ++i)
+    {
+        topics.push_back("bench/" + std::to_string(i));
+    }
+
+    // PUB/SUB joins are asynchronous; keep probing until every subscription
+    // has travelled back through the broker.
+    while (ready < run.subscribers)
+    {
+        pub.send(zmq::str_buffer("bench/warmup"), zmq::send_flags::none);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    const bool monster = run.payload == "monster";
+    flatbuffers::FlatBufferBuilder builder(1024, &RecyclingAllocator::shared());
+    const std::vector<uint8_t> inventory(run.size);
+
+    // [topic][send time][MonsterBatch], one batcher per topic.
+    BatchSettings batchSettings;
+    batchSettings.maxMonsters = options.batch;
+    batchSettings.maxBytes = std::max<size_t>(batchSettings.maxBytes, options.batch * (run.size + 64));
+    std::vector<std::unique_ptr<MonsterBatcher>> batchers;
+    if (run.payload == "batch")
+    {
+        for (const std::string &topic : topics)
+        {
+            batchers.emplace_back(new MonsterBatcher(batchSettings, [&pub, &topic](zmq::message_t &&batch, size_t) {
+                const int64_t now = Clock::now().time_since_epoch().count();
+                pub.send(zmq::buffer(topic), zmq::send_flags::sndmore);
+                pub.send(zmq::buffer(&now, sizeof(now)), zmq::send_flags::sndmore);
+                pub.send(batch, zmq::send_flags::none);
+            }));
+        }
+    }
+
+    const Clock::time_point start = Clock::now();
+    for (uint64_t i = 0; i < options.messages; ++i)
+    {
+        if (options.rate != 0)
+        {
+            const Clock::time_point due = start + std::chrono::nanoseconds(i * 1000000000ull / options.rate);
+            while (Clock::now() < due)
+            {
+                for (const std::unique_ptr<MonsterBatcher> &batcher : batchers)
+                {
+                    batcher->flushIfDue();
+                }
+            }
+        }
+
+        const std::string &topic = topics[i % topics.size()];
+        if (!batchers.empty())
+        {
+            MonsterBatcher &batcher = *batchers[i % batchers.size()];
+            flatbuffers::FlatBufferBuilder &batchBuilder = batcher.builder();
+            const auto name = batchBuilder.CreateString(topic);
+            const auto items = batchBuilder.CreateVector(inventory.data(), inventory.size());
+            MyGame::MonsterBuilder monsterBuilder(batchBuilder);
+            monsterBuilder.add_name(name);
+            monsterBuilder.add_inventory(items);
+            batcher.add(monsterBuilder.Finish());
+            continue;
+        }
+        if (monster)
+        {
+            // [topic][send time][Monster]
+            const auto name = builder.CreateString(topic);
+            const auto items = builder.CreateVector(inventory.data(), inventory.size());
+            MyGame::MonsterBuilder monsterBuilder(builder);
+            monsterBuilder.add_name(name);
+            monsterBuilder.add_inventory(items);
+            MyGame::FinishMonsterBuffer(builder, monsterBuilder.Finish());
+
+            const int64_t now = Clock::now().time_since_epoch().count();
+            pub.send(zmq::buffer(topic), zmq::send_flags::sndmore);
+            pub.send(zmq::buffer(&now, sizeof(now)), zmq::send_flags::sndmore);
+            pub.send(releaseFrame(builder), zmq::send_flags::none);
+            continue;
+        }
+
+        zmq::message_t payload(run.size);
+        if (run.size >= sizeof(int64_t))
+        {
+            const int64_t now = Clock::now().time_since_epoch().count();
+            std::memcpy(payload.data(), &now, sizeof(now));
+        }
+        pub.send(zmq::buffer(topic), zmq::send_flags::sndmore);
+        pub.send(payload, zmq::send_flags::none);
+    }
+    for (const std::unique_ptr<MonsterBatcher> &batcher : batchers)
+    {
+        batcher->flush();
+    }
+}
+
+void runBenchmark(const Run &run, const Options &options)
+{
+    const Endpoints endpoints = endpointsFor(run, options);
+    zmq::context_t context(2);
+
+    std::atomic<bool> bound{run.engine == "external"};
+    std::thread broker;
+    if (run.engine != "external")
+    {
+        broker = std::thread(runBroker, std::ref(context), std::cref(endpoints), std::cref(run.engine),
+                             std::ref(bound));
+    }
+    while (!bound)
+    {
+        std::this_thread::yield();
+    }
+
+    std::atomic<size_t> ready{0};
+    std::vector<SubscriberResult> results(run.subscribers);
+    std::vector<std::thread> subscribers;
+    for (size_t i = 0; i < run.subscribers; ++i)
+    {
+        subscribers.emplace_back(runSubscriber, std::ref(context), std::cref(endpoints), options.messages,
+                                 options.compressed && run.engine == "external", std::ref(ready),
+                                 std::ref(results[i]));
+    }
+    std::thread publisher(runPublisher, std::ref(context), std::cref(endpoints), std::cref(run), std::cref(options),
+                          std::ref(ready));
+
+    publisher.join();
+    for (std::thread &subscriber : subscribers)
+    {
+        subscriber.join();
+    }
+    context.shutdown();
+    if (broker.joinable())
+    {
+        broker.join();
+    }
+
+    uint64_t delivered = 0;
+    uint64_t invalid = 0;
+    uint64_t bytes = 0;
+    Clock::time_point first = Clock::time_point::max(), last = Clock::time_point::min();
+    LatencyHistogram::Snapshot latency;
+    for (const SubscriberResult &result : results)
+    {
+        delivered += result.received;
+        invalid += result.invalid;
+        bytes += result.bytes;
+        if (result.received != 0)
+        {
+            first = std::min(first, result.first);
+            last = std::max(last, result.last);
+        }
+        result.latency.addTo(latency);
+    }
+
+    const double seconds = delivered ? std::chrono::duration<double>(last - first).count() : 0.0;
+    const double perSubscriber = run.subscribers ? static_cast<double>(delivered) / run.subscribers : 0.0;
+    const double rate = seconds > 0 ? perSubscriber / seconds : 0.0;
+    const double byteRate =
+        seconds > 0 && run.subscribers ? static_cast<double>(bytes) / run.subscribers / seconds : 0.0;
+    std::cout << "{\"engine\":\"" << run.engine << "\",\"transport\":\""
+              << (run.engine == "external" ? "tcp" : run.transport) << "\",\"size\":" << run.size
+              << ",\"payload\":\"" << run.payload << "\",\"topics\":" << run.topics
+              << ",\"subscribers\":" << run.subscribers << ",\"messages\":" << options.messages
+              << ",\"rate\":" << options.rate << ",\"delivered\":" << delivered << ",\"invalid\":" << invalid
+              << ",\"lost\":" << options.messages * run.subscribers - delivered
+              << ",\"seconds\":" << seconds << ",\"msgs_per_sec\":" << rate
+              << ",\"delivered_per_sec\":" << rate * run.subscribers
+              << ",\"bytes_per_sec\":" << byteRate
+              << ",\"latency_ns\":{\"p50\":" << latency.percentile(0.5) << ",\"p99\":" << latency.percentile(0.99)
+              << ",\"p999\":" << latency.percentile(0.999) << ",\"max\":" << latency.max << "}}" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const Options options = parseOptions(argc, argv);
+
+    for (const std::string &engine : options.engines)
+    {
+        // An external broker is always reached over its tcp ports.
+        const std::vector<std::string> transports =
+            engine == "external" ? std::vector<std::string>{"tcp"} : options.transports;
+        for (const std::string &transport : transports)
+        {
+            for (size_t size : options.sizes)
+            {
+                for (const std::string &payload : options.payloads)
+                {
+                    for (size_t topics : options.topics)
+                    {
+                        for (size_t subscribers : options.subscribers)
+                        {
+                            runBenchmark({engine, transport, size, payload, std::max<size_t>(1, topics), subscribers},
+                                         options);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
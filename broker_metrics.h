@@ -0,0 +1,413 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Poco/Util/AbstractConfiguration.h"
+
+#include <zmq.hpp>
+
+// Every counter below has exactly one writing thread and is read by the
+// thread that publishes statistics. Writers update with a relaxed load/store
+// pair rather than a read-modify-write, so recording costs no more than a
+// plain increment and the cache line only moves when the publisher reads it.
+inline void bump(std::atomic<uint64_t> &counter, uint64_t by = 1)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+}
+
+inline uint64_t monotonicNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+struct MetricsSettings
+{
+    bool enabled = false;
+    // Local PUB endpoint the statistics are published on, empty for none.
+    std::string endpoint;
+    // Topic under which statistics are also published on XPUB, empty for none.
+    std::string sysTopic;
+    long interval = 1000;
+    size_t maxTopics = 1024;
+    size_t topTopics = 20;
+
+    static MetricsSettings fromConfig(const Poco::Util::AbstractConfiguration &config)
+    {
+        MetricsSettings settings;
+        settings.enabled = config.getBool("metrics.enable", settings.enabled);
+        settings.endpoint = config.getString("metrics.endpoint", settings.endpoint);
+        settings.sysTopic = config.getString("metrics.sys_topic", settings.sysTopic);
+        settings.interval = std::max(10, config.getInt("metrics.interval", static_cast<int>(settings.interval)));
+        settings.maxTopics = std::max(16, config.getInt("metrics.max_topics", static_cast<int>(settings.maxTopics)));
+        settings.topTopics = std::max(0, config.getInt("metrics.top_topics", static_cast<int>(settings.topTopics)));
+        return settings;
+    }
+};
+
+// Log-linear latency histogram in the spirit of HdrHistogram: 16 linear
+// sub-buckets per power of two, about 6% relative error over the full
+// 64-bit range, in a fixed 8 KB array.
+class LatencyHistogram
+{
+  public:
+    static constexpr unsigned kSubBits = 4;
+    static constexpr unsigned kSubBuckets = 1u << kSubBits;
+    static constexpr size_t kBuckets = (64 - kSubBits + 1) * kSubBuckets;
+
+    struct Snapshot
+    {
+        uint64_t count = 0;
+        uint64_t max = 0;
+        std::array<uint64_t, kBuckets> buckets{};
+
+        uint64_t percentile(double q) const
+        {
+            if (count == 0)
+            {
+                return 0;
+            }
+            const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * count + 0.5));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < kBuckets; ++i)
+            {
+                seen += buckets[i];
+                if (seen >= rank)
+                {
+                    return std::min(max, upperBound(i));
+                }
+            }
+            return max;
+        }
+    };
+
+    void record(uint64_t value)
+    {
+        bump(m_buckets[index(value)]);
+        bump(m_count);
+        if (value > m_max.load(std::memory_order_relaxed))
+        {
+            m_max.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    // Adds this histogram's counts to `snapshot`, so several threads'
+    // histograms can be merged.
+    void addTo(Snapshot &snapshot) const
+    {
+        for (size_t i = 0; i < kBuckets; ++i)
+        {
+            snapshot.buckets[i] += m_buckets[i].load(std::memory_order_relaxed);
+        }
+        snapshot.count += m_count.load(std::memory_order_relaxed);
+        snapshot.max = std::max(snapshot.max, m_max.load(std::memory_order_relaxed));
+    }
+
+    static size_t index(uint64_t value)
+    {
+        if (value < kSubBuckets)
+        {
+            return static_cast<size_t>(value);
+        }
+        const unsigned msb = 63 - static_cast<unsigned>(std::countl_zero(value));
+        const unsigned shift = msb - kSubBits;
+        return (shift + 1) * kSubBuckets + ((value >> shift) & (kSubBuckets - 1));
+    }
+
+    static uint64_t upperBound(size_t index)
+    {
+        if (index < kSubBuckets)
+        {
+            return index;
+        }
+        const unsigned shift = static_cast<unsigned>(index / kSubBuckets) - 1;
+        const uint64_t sub = index % kSubBuckets;
+        return ((kSubBuckets + sub + 1) << shift) - 1;
+    }
+
+  private:
+    std::array<std::atomic<uint64_t>, kBuckets> m_buckets{};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_max{0};
+};
+
+// Message and byte counts per topic in a fixed-size open-addressed table, so
+// counting a new topic never allocates. Topics beyond the table's capacity
+// are added to an overflow entry.
+class TopicCounters
+{
+  public:
+    static constexpr size_t kNameBytes = 64;
+    static constexpr size_t kProbes = 16;
+
+    struct Entry
+    {
+        std::atomic<uint64_t> hash{0};
+        char name[kNameBytes];
+        uint32_t nameSize = 0;
+        std::atomic<uint64_t> messages{0};
+        std::atomic<uint64_t> bytes{0};
+    };
+
+    struct Total
+    {
+        std::string topic;
+        uint64_t messages;
+        uint64_t bytes;
+    };
+
+    explicit TopicCounters(size_t capacity) : m_entries(roundUp(capacity)), m_mask(m_entries.size() - 1)
+    {
+    }
+
+    void record(uint64_t hash, const zmq::message_t &topic, size_t bytes)
+    {
+        hash |= 1; // 0 marks an empty slot
+        for (size_t probe = 0; probe < kProbes; ++probe)
+        {
+            Entry &entry = m_entries[(hash + probe) & m_mask];
+            const uint64_t current = entry.hash.load(std::memory_order_relaxed);
+            if (current == 0)
+            {
+                entry.nameSize = static_cast<uint32_t>(std::min(kNameBytes, topic.size()));
+                std::memcpy(entry.name, topic.data(), entry.nameSize);
+                entry.hash.store(hash, std::memory_order_release);
+            }
+            else if (current != hash)
+            {
+                continue;
+            }
+            bump(entry.messages);
+            bump(entry.bytes, bytes);
+            return;
+        }
+        bump(m_overflow.messages);
+        bump(m_overflow.bytes, bytes);
+    }
+
+    // Appends every topic's totals to `totals`.
+    void addTo(std::vector<Total> &totals) const
+    {
+        for (const Entry &entry : m_entries)
+        {
+            if (entry.hash.load(std::memory_order_acquire) != 0)
+            {
+                totals.push_back({std::string(entry.name, entry.nameSize), load(entry.messages), load(entry.bytes)});
+            }
+        }
+        if (load(m_overflow.messages) != 0)
+        {
+            totals.push_back({"(other)", load(m_overflow.messages), load(m_overflow.bytes)});
+        }
+    }
+
+  private:
+    static size_t roundUp(size_t capacity)
+    {
+        size_t size = 16;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    static uint64_t load(const std::atomic<uint64_t> &counter)
+    {
+        return counter.load(std::memory_order_relaxed);
+    }
+
+    std::vector<Entry> m_entries;
+    const size_t m_mask;
+    Entry m_overflow;
+};
+
+// Counters owned by one broker thread (the broker thread itself or a shard).
+struct BrokerMetrics
+{
+    explicit BrokerMetrics(size_t maxTopics) : topics(maxTopics)
+    {
+    }
+
+    std::atomic<uint64_t> messages{0};
+    std::atomic<uint64_t> bytes{0};
+    // Messages a stage decided not to forward.
+    std::atomic<uint64_t> filtered{0};
+    // Messages XPUB refused because a subscriber reached its send HWM.
+    std::atomic<uint64_t> hwmDrops{0};
+    // Updates of conflatable topics XPUB refused and the broker held back,
+    // and held-back updates replaced by a newer one (conflate.topics).
+    std::atomic<uint64_t> deferred{0};
+    std::atomic<uint64_t> conflated{0};
+    // Times XSUB reading paused because a shard's pipe was full.
+    std::atomic<uint64_t> shardStalls{0};
+    // Payloads checked by ingress verification, and those that failed.
+    std::atomic<uint64_t> verified{0};
+    std::atomic<uint64_t> rejected{0};
+    // Payload frames compressed for egress, frames that compressed too poorly
+    // to send that way, and their bytes before and after (compress.enable).
+    std::atomic<uint64_t> compressed{0};
+    std::atomic<uint64_t> compressSkipped{0};
+    std::atomic<uint64_t> compressIn{0};
+    std::atomic<uint64_t> compressOut{0};
+    TopicCounters topics;
+    // Time from a message arriving on XSUB to it being handed to XPUB.
+    LatencyHistogram latency;
+    // Time spent verifying one payload.
+    LatencyHistogram verifyLatency;
+    // Time spent compressing one payload frame, kept or not.
+    LatencyHistogram compressLatency;
+};
+
+// Formats the statistics of a set of per-thread BrokerMetrics as one JSON
+// object. Runs on the publishing thread only.
+class MetricsReport
+{
+  public:
+    struct Shard
+    {
+        const BrokerMetrics *metrics;
+        uint64_t queueDepth;
+    };
+
+    static std::string format(const BrokerMetrics &broker, const std::vector<Shard> &shards, size_t topTopics)
+    {
+        LatencyHistogram::Snapshot latency;
+        broker.latency.addTo(latency);
+
+        uint64_t verified = load(broker.verified);
+        uint64_t rejected = load(broker.rejected);
+        LatencyHistogram::Snapshot verifyLatency;
+        broker.verifyLatency.addTo(verifyLatency);
+        uint64_t compressed = 0, compressSkipped = 0, compressIn = 0, compressOut = 0;
+        LatencyHistogram::Snapshot compressLatency;
+        for (const Shard &shard : shards)
+        {
+            verified += load(shard.metrics->verified);
+            rejected += load(shard.metrics->rejected);
+            shard.metrics->verifyLatency.addTo(verifyLatency);
+            compressed += load(shard.metrics->compressed);
+            compressSkipped += load(shard.metrics->compressSkipped);
+            compressIn += load(shard.metrics->compressIn);
+            compressOut += load(shard.metrics->compressOut);
+            shard.metrics->compressLatency.addTo(compressLatency);
+        }
+
+        std::vector<TopicCounters::Total> topics = mergeTopics(broker, shards);
+        std::sort(topics.begin(), topics.end(),
+                  [](const TopicCounters::Total &a, const TopicCounters::Total &b) { return a.messages > b.messages; });
+        topics.resize(std::min(topics.size(), topTopics));
+
+        std::ostringstream out;
+        out << "{\"time\":" << std::chrono::duration_cast<std::chrono::milliseconds>(
+                                   std::chrono::system_clock::now().time_since_epoch())
+                                   .count();
+        out << ",\"messages\":" << load(broker.messages) << ",\"bytes\":" << load(broker.bytes)
+            << ",\"filtered\":" << load(broker.filtered) << ",\"hwm_drops\":" << load(broker.hwmDrops)
+            << ",\"deferred\":" << load(broker.deferred) << ",\"conflated\":" << load(broker.conflated)
+            << ",\"shard_stalls\":" << load(broker.shardStalls);
+
+        out << ",\"latency_ns\":{\"count\":" << latency.count << ",\"p50\":" << latency.percentile(0.5)
+            << ",\"p90\":" << latency.percentile(0.9) << ",\"p99\":" << latency.percentile(0.99)
+            << ",\"p999\":" << latency.percentile(0.999) << ",\"max\":" << latency.max << "}";
+
+        out << ",\"verify\":{\"checked\":" << verified << ",\"rejected\":" << rejected
+            << ",\"latency_ns\":{\"p50\":" << verifyLatency.percentile(0.5)
+            << ",\"p99\":" << verifyLatency.percentile(0.99) << ",\"max\":" << verifyLatency.max << "}}";
+
+        // ratio is compressed over original bytes of the frames sent compressed.
+        out << ",\"compress\":{\"frames\":" << compressed << ",\"skipped\":" << compressSkipped
+            << ",\"bytes_in\":" << compressIn << ",\"bytes_out\":" << compressOut
+            << ",\"ratio\":" << (compressIn ? static_cast<double>(compressOut) / compressIn : 1.0)
+            << ",\"latency_ns\":{\"p50\":" << compressLatency.percentile(0.5)
+            << ",\"p99\":" << compressLatency.percentile(0.99) << ",\"max\":" << compressLatency.max << "}}";
+
+        out << ",\"shards\":[";
+        for (size_t i = 0; i < shards.size(); ++i)
+        {
+            const BrokerMetrics &shard = *shards[i].metrics;
+            out << (i ? "," : "") << "{\"messages\":" << load(shard.messages) << ",\"bytes\":" << load(shard.bytes)
+                << ",\"filtered\":" << load(shard.filtered) << ",\"queue_depth\":" << shards[i].queueDepth << "}";
+        }
+
+        out << "],\"topics\":[";
+        for (size_t i = 0; i < topics.size(); ++i)
+        {
+            out << (i ? "," : "") << "{\"topic\":\"" << escape(topics[i].topic)
+                << "\",\"messages\":" << topics[i].messages << ",\"bytes\":" << topics[i].bytes << "}";
+        }
+        out << "]}";
+        return out.str();
+    }
+
+  private:
+    static uint64_t load(const std::atomic<uint64_t> &counter)
+    {
+        return counter.load(std::memory_order_relaxed);
+    }
+
+    // A topic normally lives on one shard, but "(other)" and hash collisions
+    // can appear in several tables.
+    static std::vector<TopicCounters::Total> mergeTopics(const BrokerMetrics &broker, const std::vector<Shard> &shards)
+    {
+        std::vector<TopicCounters::Total> all;
+        broker.topics.addTo(all);
+        for (const Shard &shard : shards)
+        {
+            shard.metrics->topics.addTo(all);
+        }
+        std::sort(all.begin(), all.end(),
+                  [](const TopicCounters::Total &a, const TopicCounters::Total &b) { return a.topic < b.topic; });
+
+        std::vector<TopicCounters::Total> merged;
+        for (TopicCounters::Total &total : all)
+        {
+            if (!merged.empty() && merged.back().topic == total.topic)
+            {
+                merged.back().messages += total.messages;
+                merged.back().bytes += total.bytes;
+            }
+            else
+            {
+                merged.push_back(std::move(total));
+            }
+        }
+        return merged;
+    }
+
+    static std::string escape(std::string_view text)
+    {
+        static const char hex[] = "0123456789abcdef";
+        std::string escaped;
+        for (char c : text)
+        {
+            const unsigned char u = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\')
+            {
+                escaped += '\\';
+                escaped += c;
+            }
+            else if (u < 0x20 || u >= 0x7f)
+            {
+                escaped += "\\u00";
+                escaped += hex[u >> 4];
+                escaped += hex[u & 15];
+            }
+            else
+            {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+};
@@ -0,0 +1,540 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "Poco/DateTimeFormatter.h"
+#include "Poco/DirectoryIterator.h"
+#include "Poco/Event.h"
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+#include "Poco/Path.h"
+#include "Poco/Runnable.h"
+#include "Poco/SharedMemory.h"
+#include "Poco/Thread.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Util/AbstractConfiguration.h"
+
+#include "broker_metrics.h"
+#include "spsc_ring.h"
+#include "thread_placement.h"
+#include "zmq_forwarder.h"
+
+struct CaptureSettings
+{
+    bool enabled = false;
+    std::string directory = "capture";
+    // Size of each segment file; a record larger than this gets a segment of its own.
+    size_t segmentBytes = size_t(256) << 20;
+    // Microseconds between time entries in the index; each topic is also
+    // indexed once per interval.
+    int64_t indexInterval = 1000;
+    // Topics indexed per interval; further topics only get the time entry.
+    size_t indexTopics = 1024;
+    // Messages queued for the writer thread before new ones are dropped.
+    size_t capacity = 65536;
+
+    static CaptureSettings fromConfig(const Poco::Util::AbstractConfiguration &config)
+    {
+        CaptureSettings settings;
+        settings.enabled = config.getBool("capture.enable", settings.enabled);
+        settings.directory = config.getString("capture.directory", settings.directory);
+        settings.segmentBytes = static_cast<size_t>(
+            std::max(Poco::Int64(1) << 20, config.getInt64("capture.segment_bytes", settings.segmentBytes)));
+        settings.indexInterval =
+            std::max(Poco::Int64(1), config.getInt64("capture.index_interval", settings.indexInterval));
+        settings.indexTopics =
+            std::max(0, config.getInt("capture.index_topics", static_cast<int>(settings.indexTopics)));
+        settings.capacity = std::max(2, config.getInt("capture.capacity", static_cast<int>(settings.capacity)));
+        return settings;
+    }
+};
+
+// Capture files. A segment (.cap) and its index (.idx) both start with a
+// CaptureFileHeader. The segment then holds records back to back, each a
+// CaptureRecordHeader followed by its frames as a 32-bit size and the bytes,
+// padded to 8 bytes; a zero `bytes` or the end of the file ends the data.
+// The index is a sequence of CaptureIndexEntry pointing into the segment.
+// Everything is in host byte order.
+struct CaptureFileHeader
+{
+    static constexpr char kSegmentMagic[8] = {'P', 'O', 'C', 'O', 'C', 'A', 'P', 'S'};
+    static constexpr char kIndexMagic[8] = {'P', 'O', 'C', 'O', 'C', 'A', 'P', 'I'};
+    static constexpr uint32_t kVersion = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t shard;
+    // Epoch microseconds.
+    int64_t created;
+    uint64_t sequence;
+    uint8_t reserved[32];
+};
+
+struct CaptureRecordHeader
+{
+    // Whole record, header and padding included.
+    uint32_t bytes;
+    uint32_t frames;
+    // Epoch microseconds at which the broker forwarded the message.
+    int64_t time;
+};
+
+// `topic` is the topicHash() of the record's first frame, or 0 for an entry
+// that only marks time.
+struct CaptureIndexEntry
+{
+    int64_t time;
+    uint64_t topic;
+    uint64_t offset;
+};
+
+static_assert(sizeof(CaptureFileHeader) == 64, "capture file header layout");
+static_assert(sizeof(CaptureRecordHeader) == 16, "capture record header layout");
+static_assert(sizeof(CaptureIndexEntry) == 24, "capture index entry layout");
+
+// Records every message the broker forwards into segmented memory-mapped
+// files. capture() runs on the forwarding thread and only takes a reference
+// to each frame (zmq_msg_copy shares the payload rather than copying it)
+// into a preallocated ring slot; a writer thread copies the frames into the
+// current segment and writes the sparse index. A full ring drops the message
+// from the capture, never from the broker, and counts it.
+//
+// Segments are preallocated sparse files, mapped whole, and cut down to
+// their used size when closed. The mapping survives a crash of the broker,
+// not of the machine: nothing is synced to disk explicitly. All shards of a
+// broker run write under one run name from newRun(), and an existing file is
+// never written over: the writer stops instead.
+class CaptureLog : public Poco::Runnable
+{
+  public:
+    CaptureLog(const CaptureSettings &settings, size_t shard)
+        : m_settings(settings), m_shard(shard), m_ring(settings.enabled ? settings.capacity : 2),
+          m_thread{"capture-" + std::to_string(shard)}
+    {
+    }
+
+    ~CaptureLog()
+    {
+        stop();
+    }
+
+    // The name for a new run: its start time, with a -2, -3, ... suffix if
+    // files of a run by that name are already in the capture directory.
+    static std::string newRun(const CaptureSettings &settings)
+    {
+        Poco::File(settings.directory).createDirectories();
+        const std::string time = Poco::DateTimeFormatter::format(Poco::Timestamp(), "%Y%m%d-%H%M%S");
+        std::string run = time;
+        for (int suffix = 2; runExists(settings.directory, run); ++suffix)
+        {
+            run = time + "-" + std::to_string(suffix);
+        }
+        return run;
+    }
+
+    // `run` names the segments, see newRun().
+    void start(const std::string &run)
+    {
+        if (m_settings.enabled && !m_thread.isRunning())
+        {
+            Poco::File(m_settings.directory).createDirectories();
+            m_run = run;
+            m_stopped = false;
+            m_thread.start(*this);
+        }
+    }
+
+    void stop()
+    {
+        if (m_thread.isRunning())
+        {
+            m_stopped = true;
+            m_wakeup.set();
+            m_thread.join();
+        }
+    }
+
+    // Called on the forwarding thread for every forwarded message.
+    void capture(Multipart &message)
+    {
+        if (!m_settings.enabled)
+        {
+            return;
+        }
+
+        const int64_t now = Poco::Timestamp().epochMicroseconds();
+        const bool pushed = m_ring.tryPush([&](Record &record) {
+            record.time = now;
+            record.count = message.size();
+            if (record.frames.size() < record.count)
+            {
+                record.frames.resize(record.count);
+            }
+            for (size_t i = 0; i < record.count; ++i)
+            {
+                record.frames[i].copy(message[i]);
+            }
+        });
+
+        if (!pushed)
+        {
+            bump(m_dropped);
+            return;
+        }
+
+        // Only wake the writer if it went to sleep on an empty ring.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleeping.load(std::memory_order_relaxed))
+        {
+            m_sleeping.store(false, std::memory_order_relaxed);
+            m_wakeup.set();
+        }
+    }
+
+    uint64_t captured() const
+    {
+        return m_captured.load(std::memory_order_relaxed);
+    }
+
+    uint64_t dropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+    uint64_t segments() const
+    {
+        return m_segments.load(std::memory_order_relaxed);
+    }
+
+    void run() override
+    {
+        ThreadPlacement::apply();
+        while (!m_stopped.load(std::memory_order_relaxed))
+        {
+            if (writeAvailable() == 0)
+            {
+                // Let readers of the live segment see the index so far.
+                if (m_index.is_open())
+                {
+                    m_index.flush();
+                }
+                m_sleeping.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (m_ring.empty() && !m_stopped.load(std::memory_order_relaxed))
+                {
+                    m_wakeup.wait();
+                }
+                m_sleeping.store(false, std::memory_order_relaxed);
+            }
+        }
+        writeAvailable();
+        closeSegment();
+    }
+
+  private:
+    static constexpr size_t kAlignment = 8;
+
+    struct Record
+    {
+        int64_t time = 0;
+        size_t count = 0;
+        std::vector<zmq::message_t> frames;
+    };
+
+    static size_t align(size_t bytes)
+    {
+        return (bytes + kAlignment - 1) & ~(kAlignment - 1);
+    }
+
+    static bool runExists(const std::string &directory, const std::string &run)
+    {
+        const std::string prefix = run + "-s";
+        for (Poco::DirectoryIterator it(directory), end; it != end; ++it)
+        {
+            if (it.name().rfind(prefix, 0) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t writeAvailable()
+    {
+        return m_ring.drain([this](Record &record) { write(record); });
+    }
+
+    void write(Record &record)
+    {
+        size_t bytes = sizeof(CaptureRecordHeader);
+        for (size_t i = 0; i < record.count; ++i)
+        {
+            bytes += sizeof(uint32_t) + record.frames[i].size();
+        }
+        bytes = align(bytes);
+        if (m_base == nullptr || m_offset + bytes > m_size)
+        {
+            openSegment(bytes);
+        }
+
+        char *at = m_base + m_offset;
+        char *out = at + sizeof(CaptureRecordHeader);
+        const uint64_t topic = topicHash(record.frames[0]);
+        for (size_t i = 0; i < record.count; ++i)
+        {
+            zmq::message_t &frame = record.frames[i];
+            const uint32_t size = static_cast<uint32_t>(frame.size());
+            std::memcpy(out, &size, sizeof(size));
+            std::memcpy(out + sizeof(size), frame.data(), size);
+            out += sizeof(size) + size;
+            // Drop the reference now rather than when the slot is reused.
+            frame.rebuild();
+        }
+
+        // The header goes in last, so a reader of the live segment never
+        // sees a record whose frames are not there yet.
+        const CaptureRecordHeader header{static_cast<uint32_t>(bytes), static_cast<uint32_t>(record.count),
+                                         record.time};
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(at, &header, sizeof(header));
+
+        index(record.time, topic, m_offset);
+        m_offset += bytes;
+        bump(m_captured);
+    }
+
+    // A time entry at the start of each interval, and an entry for the
+    // first record of each topic within the interval.
+    void index(int64_t time, uint64_t topic, uint64_t offset)
+    {
+        if (time >= m_intervalEnd)
+        {
+            appendIndex({time, 0, offset});
+            m_intervalEnd = time + m_settings.indexInterval;
+            m_indexedTopics.clear();
+        }
+        if (m_indexedTopics.size() < m_settings.indexTopics && m_indexedTopics.insert(topic).second)
+        {
+            appendIndex({time, topic, offset});
+        }
+    }
+
+    void appendIndex(const CaptureIndexEntry &entry)
+    {
+        m_index.write(reinterpret_cast<const char *>(&entry), sizeof(entry));
+    }
+
+    void openSegment(size_t recordBytes)
+    {
+        closeSegment();
+
+        const uint64_t sequence = m_segments.load(std::memory_order_relaxed);
+        bump(m_segments);
+        Poco::Path path(m_settings.directory);
+        path.makeDirectory();
+        path.setFileName(m_run + "-s" + std::to_string(m_shard) + "-" + std::to_string(sequence) + ".cap");
+        m_path = path.toString();
+
+        Poco::File file(m_path);
+        if (!file.createFile())
+        {
+            // Ends the writer; later messages are counted as dropped.
+            throw Poco::FileExistsException(m_path);
+        }
+        m_size = std::max(m_settings.segmentBytes, sizeof(CaptureFileHeader) + recordBytes);
+        file.setSize(m_size);
+        Poco::SharedMemory(file, Poco::SharedMemory::AM_WRITE).swap(m_memory);
+        m_base = m_memory.begin();
+
+        CaptureFileHeader header{};
+        std::memcpy(header.magic, CaptureFileHeader::kSegmentMagic, sizeof(header.magic));
+        header.version = CaptureFileHeader::kVersion;
+        header.shard = static_cast<uint32_t>(m_shard);
+        header.created = Poco::Timestamp().epochMicroseconds();
+        header.sequence = sequence;
+        std::memcpy(m_base, &header, sizeof(header));
+        m_offset = sizeof(header);
+
+        path.setExtension("idx");
+        m_index.open(path.toString(), std::ios::binary | std::ios::trunc);
+        std::memcpy(header.magic, CaptureFileHeader::kIndexMagic, sizeof(header.magic));
+        m_index.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+        m_intervalEnd = std::numeric_limits<int64_t>::min();
+        m_indexedTopics.clear();
+    }
+
+    void closeSegment()
+    {
+        if (m_base == nullptr)
+        {
+            return;
+        }
+        Poco::SharedMemory().swap(m_memory);
+        m_base = nullptr;
+        Poco::File(m_path).setSize(m_offset);
+        m_index.close();
+    }
+
+    CaptureSettings m_settings;
+    const size_t m_shard;
+    SpscRing<Record> m_ring;
+    std::string m_run;
+
+    // Writer thread only.
+    Poco::SharedMemory m_memory;
+    std::string m_path;
+    char *m_base = nullptr;
+    size_t m_size = 0;
+    size_t m_offset = 0;
+    std::ofstream m_index;
+    int64_t m_intervalEnd = 0;
+    std::unordered_set<uint64_t> m_indexedTopics;
+
+    std::atomic<uint64_t> m_segments{0};
+    std::atomic<uint64_t> m_captured{0};
+    std::atomic<uint64_t> m_dropped{0};
+    std::atomic<bool> m_sleeping{false};
+    std::atomic<bool> m_stopped{false};
+    Poco::Event m_wakeup;
+    Poco::Thread m_thread;
+};
+
+// Reads a capture segment in place, record by record, with frames pointing
+// into the mapping; they stay valid as long as the reader does. Stops at the
+// end of the data, including a record the writer has not finished yet.
+//
+//   CaptureReader reader(path);
+//   CaptureReader::Record record;
+//   while (reader.next(record))
+//       use(record.time, record.frames);
+class CaptureReader
+{
+  public:
+    struct Frame
+    {
+        const char *data;
+        uint32_t size;
+    };
+
+    struct Record
+    {
+        int64_t time = 0;
+        std::vector<Frame> frames;
+    };
+
+    explicit CaptureReader(const std::string &path)
+        : m_path(path), m_memory(Poco::File(path), Poco::SharedMemory::AM_READ), m_base(m_memory.begin()),
+          m_size(static_cast<size_t>(m_memory.end() - m_memory.begin()))
+    {
+        if (m_size < sizeof(CaptureFileHeader))
+        {
+            throw Poco::DataFormatException("capture segment too short", path);
+        }
+        std::memcpy(&m_header, m_base, sizeof(m_header));
+        if (std::memcmp(m_header.magic, CaptureFileHeader::kSegmentMagic, sizeof(m_header.magic)) != 0 ||
+            m_header.version != CaptureFileHeader::kVersion)
+        {
+            throw Poco::DataFormatException("not a capture segment", path);
+        }
+        rewind();
+    }
+
+    CaptureReader(const CaptureReader &) = delete;
+    CaptureReader &operator=(const CaptureReader &) = delete;
+
+    const CaptureFileHeader &header() const
+    {
+        return m_header;
+    }
+
+    void rewind()
+    {
+        m_offset = sizeof(CaptureFileHeader);
+    }
+
+    bool next(Record &record)
+    {
+        CaptureRecordHeader header;
+        if (m_offset + sizeof(header) > m_size)
+        {
+            return false;
+        }
+        std::memcpy(&header, m_base + m_offset, sizeof(header));
+        if (header.bytes < sizeof(header) || header.bytes > m_size - m_offset)
+        {
+            return false;
+        }
+
+        const char *at = m_base + m_offset + sizeof(header);
+        const char *end = m_base + m_offset + header.bytes;
+        record.time = header.time;
+        record.frames.clear();
+        for (uint32_t i = 0; i < header.frames; ++i)
+        {
+            uint32_t size;
+            if (static_cast<size_t>(end - at) < sizeof(size))
+            {
+                return false;
+            }
+            std::memcpy(&size, at, sizeof(size));
+            at += sizeof(size);
+            if (static_cast<size_t>(end - at) < size)
+            {
+                return false;
+            }
+            record.frames.push_back({at, size});
+            at += size;
+        }
+        m_offset += header.bytes;
+        return true;
+    }
+
+    // Moves to the first record at or after `time` (epoch microseconds),
+    // starting from the closest time entry of the segment's index, or from
+    // the first record if there is no index.
+    void seek(int64_t time)
+    {
+        rewind();
+        Poco::Path index(m_path);
+        index.setExtension("idx");
+        std::ifstream in(index.toString(), std::ios::binary);
+        CaptureFileHeader header;
+        if (in.read(reinterpret_cast<char *>(&header), sizeof(header)) &&
+            std::memcmp(header.magic, CaptureFileHeader::kIndexMagic, sizeof(header.magic)) == 0)
+        {
+            CaptureIndexEntry entry;
+            while (in.read(reinterpret_cast<char *>(&entry), sizeof(entry)) && entry.time <= time)
+            {
+                if (entry.topic == 0 && entry.offset < m_size)
+                {
+                    m_offset = entry.offset;
+                }
+            }
+        }
+
+        Record record;
+        size_t before = m_offset;
+        while (next(record) && record.time < time)
+        {
+            before = m_offset;
+        }
+        m_offset = before;
+    }
+
+  private:
+    std::string m_path;
+    Poco::SharedMemory m_memory;
+    const char *m_base;
+    size_t m_size;
+    size_t m_offset = 0;
+    CaptureFileHeader m_header;
+};
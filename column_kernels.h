@@ -0,0 +1,312 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+// The AVX2 kernels are compiled for AVX2 whatever the build's -m flags and
+// only picked at run time on a CPU that has it.
+#define COLUMN_KERNELS_AVX2 1
+#define COLUMN_KERNELS_TARGET __attribute__((target("avx2,bmi,popcnt")))
+#endif
+
+template <typename T> struct Range
+{
+    T min;
+    T max;
+
+    static Range empty()
+    {
+        if constexpr (std::numeric_limits<T>::has_infinity)
+        {
+            return {std::numeric_limits<T>::infinity(), -std::numeric_limits<T>::infinity()};
+        }
+        else
+        {
+            return {std::numeric_limits<T>::max(), std::numeric_limits<T>::lowest()};
+        }
+    }
+
+    // Also skips NaN, as the AVX2 min/max do when it is the first operand.
+    void add(T value)
+    {
+        min = value < min ? value : min;
+        max = value > max ? value : max;
+    }
+
+    void add(const Range &other)
+    {
+        min = other.min < min ? other.min : min;
+        max = other.max > max ? other.max : max;
+    }
+
+    bool operator==(const Range &) const = default;
+};
+
+// Reference kernels over one column, one element at a time.
+struct ScalarKernels
+{
+    static Range<float> minMax(const float *values, size_t count)
+    {
+        Range<float> range = Range<float>::empty();
+        for (size_t i = 0; i < count; ++i)
+        {
+            range.add(values[i]);
+        }
+        return range;
+    }
+
+    static Range<int16_t> minMax(const int16_t *values, size_t count)
+    {
+        Range<int16_t> range = Range<int16_t>::empty();
+        for (size_t i = 0; i < count; ++i)
+        {
+            range.add(values[i]);
+        }
+        return range;
+    }
+
+    static int64_t sum(const int16_t *values, size_t count)
+    {
+        int64_t sum = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            sum += values[i];
+        }
+        return sum;
+    }
+
+    static size_t countEqual(const int8_t *values, size_t count, int8_t value)
+    {
+        size_t matches = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            matches += values[i] == value;
+        }
+        return matches;
+    }
+
+    // Writes the index of every value >= threshold to `out`, which must have
+    // room for `count` indices, and returns how many it wrote.
+    static size_t filterAtLeast(const int16_t *values, size_t count, int16_t threshold, uint32_t *out)
+    {
+        size_t matches = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            out[matches] = static_cast<uint32_t>(i);
+            matches += values[i] >= threshold;
+        }
+        return matches;
+    }
+};
+
+#ifdef COLUMN_KERNELS_AVX2
+// The same kernels 8 floats, 16 shorts or 32 bytes at a time, finishing the
+// tail with the scalar loop. Columns need no particular alignment.
+struct Avx2Kernels
+{
+    COLUMN_KERNELS_TARGET static Range<float> minMax(const float *values, size_t count)
+    {
+        const Range<float> empty = Range<float>::empty();
+        __m256 low = _mm256_set1_ps(empty.min);
+        __m256 high = _mm256_set1_ps(empty.max);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            // With a NaN in the first operand these return the second.
+            const __m256 x = _mm256_loadu_ps(values + i);
+            low = _mm256_min_ps(x, low);
+            high = _mm256_max_ps(x, high);
+        }
+        alignas(32) float lows[8];
+        alignas(32) float highs[8];
+        _mm256_store_ps(lows, low);
+        _mm256_store_ps(highs, high);
+
+        Range<float> range = ScalarKernels::minMax(values + i, count - i);
+        for (int lane = 0; lane < 8; ++lane)
+        {
+            range.add(Range<float>{lows[lane], highs[lane]});
+        }
+        return range;
+    }
+
+    COLUMN_KERNELS_TARGET static Range<int16_t> minMax(const int16_t *values, size_t count)
+    {
+        const Range<int16_t> empty = Range<int16_t>::empty();
+        __m256i low = _mm256_set1_epi16(empty.min);
+        __m256i high = _mm256_set1_epi16(empty.max);
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i));
+            low = _mm256_min_epi16(x, low);
+            high = _mm256_max_epi16(x, high);
+        }
+        alignas(32) int16_t lows[16];
+        alignas(32) int16_t highs[16];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lows), low);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(highs), high);
+
+        Range<int16_t> range = ScalarKernels::minMax(values + i, count - i);
+        for (int lane = 0; lane < 16; ++lane)
+        {
+            range.add(Range<int16_t>{lows[lane], highs[lane]});
+        }
+        return range;
+    }
+
+    COLUMN_KERNELS_TARGET static int64_t sum(const int16_t *values, size_t count)
+    {
+        // madd adds neighbouring shorts into 8 int lanes of at most 2^16
+        // each, so the lanes are widened before 2^15 iterations can overflow.
+        constexpr size_t kBlock = 16 * 16384;
+        const __m256i ones = _mm256_set1_epi16(1);
+        int64_t sum = 0;
+        size_t i = 0;
+        while (i + 16 <= count)
+        {
+            const size_t end = i + std::min(kBlock, (count - i) / 16 * 16);
+            __m256i lanes = _mm256_setzero_si256();
+            for (; i < end; i += 16)
+            {
+                const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i));
+                lanes = _mm256_add_epi32(lanes, _mm256_madd_epi16(x, ones));
+            }
+            alignas(32) int32_t partial[8];
+            _mm256_store_si256(reinterpret_cast<__m256i *>(partial), lanes);
+            for (int32_t lane : partial)
+            {
+                sum += lane;
+            }
+        }
+        return sum + ScalarKernels::sum(values + i, count - i);
+    }
+
+    COLUMN_KERNELS_TARGET static size_t countEqual(const int8_t *values, size_t count, int8_t value)
+    {
+        const __m256i wanted = _mm256_set1_epi8(value);
+        size_t matches = 0;
+        size_t i = 0;
+        for (; i + 32 <= count; i += 32)
+        {
+            const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i));
+            const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, wanted)));
+            matches += std::popcount(mask);
+        }
+        return matches + ScalarKernels::countEqual(values + i, count - i, value);
+    }
+
+    COLUMN_KERNELS_TARGET static size_t filterAtLeast(const int16_t *values, size_t count, int16_t threshold,
+                                                      uint32_t *out)
+    {
+        const __m256i limit = _mm256_set1_epi16(threshold);
+        size_t matches = 0;
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i));
+            // Two mask bits per short; keep the low one of each value >= limit.
+            const uint32_t below = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi16(limit, x)));
+            for (uint32_t mask = ~below & 0x55555555u; mask != 0; mask &= mask - 1)
+            {
+                out[matches++] = static_cast<uint32_t>(i + (std::countr_zero(mask) >> 1));
+            }
+        }
+        const size_t tail = ScalarKernels::filterAtLeast(values + i, count - i, threshold, out + matches);
+        for (size_t j = matches; j < matches + tail; ++j)
+        {
+            out[j] += static_cast<uint32_t>(i);
+        }
+        return matches + tail;
+    }
+};
+#endif
+
+// One set of column kernels, picked once and called through pointers:
+//
+//   const ColumnKernels &kernels = ColumnKernels::best();
+//   const int64_t total = kernels.sum(hp.data(), hp.size());
+struct ColumnKernels
+{
+    const char *name;
+    Range<float> (*minMaxFloat)(const float *values, size_t count);
+    Range<int16_t> (*minMaxShort)(const int16_t *values, size_t count);
+    int64_t (*sum)(const int16_t *values, size_t count);
+    size_t (*countEqual)(const int8_t *values, size_t count, int8_t value);
+    size_t (*filterAtLeast)(const int16_t *values, size_t count, int16_t threshold, uint32_t *out);
+
+    static const ColumnKernels &scalar()
+    {
+        static const ColumnKernels kernels = of<ScalarKernels>("scalar");
+        return kernels;
+    }
+
+    // The AVX2 kernels if this build has them and the CPU supports them.
+    static const ColumnKernels *avx2()
+    {
+#ifdef COLUMN_KERNELS_AVX2
+        static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") &&
+                                      __builtin_cpu_supports("popcnt");
+        static const ColumnKernels kernels = of<Avx2Kernels>("avx2");
+        return supported ? &kernels : nullptr;
+#else
+        return nullptr;
+#endif
+    }
+
+    static const ColumnKernels &best()
+    {
+        const ColumnKernels *vector = avx2();
+        return vector ? *vector : scalar();
+    }
+
+  private:
+    template <typename Kernels> static ColumnKernels of(const char *name)
+    {
+        return {name,          &Kernels::minMax, &Kernels::minMax, &Kernels::sum, &Kernels::countEqual,
+                &Kernels::filterAtLeast};
+    }
+};
+
+// Adds each value to the bin (value - low) / width, clamped to the first and
+// last bin. Histograms have no AVX2 kernel: without a conflict-free scatter,
+// vector code loses to four interleaved scalar counters.
+inline void columnHistogram(const int16_t *values, size_t count, int32_t low, uint32_t width,
+                            std::span<uint64_t> bins)
+{
+    if (bins.empty() || width == 0)
+    {
+        return;
+    }
+    const int64_t last = static_cast<int64_t>(bins.size()) - 1;
+    const auto bin = [&](int16_t value) {
+        const int64_t index = value < low ? 0 : (static_cast<int64_t>(value) - low) / width;
+        return static_cast<size_t>(index > last ? last : index);
+    };
+
+    // Separate counters so repeated values do not serialize on one bin.
+    std::vector<uint64_t> lanes(bins.size() * 4, 0);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        ++lanes[bin(values[i]) * 4];
+        ++lanes[bin(values[i + 1]) * 4 + 1];
+        ++lanes[bin(values[i + 2]) * 4 + 2];
+        ++lanes[bin(values[i + 3]) * 4 + 3];
+    }
+    for (; i < count; ++i)
+    {
+        ++lanes[bin(values[i]) * 4];
+    }
+    for (size_t b = 0; b < bins.size(); ++b)
+    {
+        bins[b] += lanes[b * 4] + lanes[b * 4 + 1] + lanes[b * 4 + 2] + lanes[b * 4 + 3];
+    }
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Poco/StringTokenizer.h"
+#include "Poco/Util/AbstractConfiguration.h"
+
+#include <zmq.hpp>
+
+#include "broker_metrics.h"
+#include "zmq_forwarder.h"
+
+struct ConflateSettings
+{
+    // Topic prefixes whose updates may be collapsed to the latest one; no
+    // conflation if empty.
+    std::vector<std::string> topics;
+    // Topics held back at once; refused messages of further topics are dropped.
+    size_t maxPending = 4096;
+    // Milliseconds between attempts to send held-back updates.
+    long retry = 1;
+
+    bool enabled() const
+    {
+        return !topics.empty();
+    }
+
+    static ConflateSettings fromConfig(const Poco::Util::AbstractConfiguration &config)
+    {
+        ConflateSettings settings;
+        Poco::StringTokenizer topics(config.getString("conflate.topics", ""), ",",
+                                     Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+        settings.topics.assign(topics.begin(), topics.end());
+        settings.maxPending =
+            std::max(1, config.getInt("conflate.max_pending", static_cast<int>(settings.maxPending)));
+        settings.retry = std::max(1, config.getInt("conflate.retry", static_cast<int>(settings.retry)));
+        return settings;
+    }
+};
+
+// Sends on XPUB without waiting and, for conflatable topics, turns the
+// messages XPUB refuses into a held-back latest value per topic instead of
+// dropping them. While a topic has an update held back, newer updates of it
+// replace that one rather than being sent, so a lagging subscriber gets the
+// newest state once it catches up and per-topic order still holds. flush()
+// retries the held-back updates, oldest topic first.
+//
+// XPUB refuses a message (ZMQ_XPUB_NODROP) when any subscriber it matches is
+// at its send HWM, and libzmq neither says which one nor reports XPUB as
+// writable again, so conflation applies to the topic as a whole on a retry
+// timer: every subscriber of a topic sees its conflated stream while one of
+// them lags. Runs on the thread that owns XPUB and `metrics`.
+class Conflator
+{
+  public:
+    enum class Outcome
+    {
+        Sent,
+        Held,
+        Dropped
+    };
+
+    Conflator(const ConflateSettings &settings, BrokerMetrics &metrics) : m_settings(settings), m_metrics(metrics)
+    {
+    }
+
+    Conflator(const Conflator &) = delete;
+    Conflator &operator=(const Conflator &) = delete;
+
+    // `trySend(Multipart &)` sends to XPUB without waiting and returns false
+    // if XPUB refused the message. Unless the message was dropped, `message`
+    // is only fit to receive into afterwards.
+    template <typename Send> Outcome send(Multipart &message, Send &&trySend)
+    {
+        if (!m_held.empty())
+        {
+            const auto held = m_topics.find(message.front().to_string_view());
+            if (held != m_topics.end())
+            {
+                std::swap(held->second->message, message);
+                bump(m_metrics.conflated);
+                return Outcome::Held;
+            }
+        }
+        if (trySend(message))
+        {
+            return Outcome::Sent;
+        }
+        if (m_held.size() == m_settings.maxPending || !conflatable(message.front()))
+        {
+            return Outcome::Dropped;
+        }
+
+        m_held.emplace_back();
+        Held &held = m_held.back();
+        held.topic = message.front().to_string_view();
+        std::swap(held.message, message);
+        m_topics.emplace(held.topic, std::prev(m_held.end()));
+        bump(m_metrics.deferred);
+        return Outcome::Held;
+    }
+
+    // Tries every held-back update once; those XPUB still refuses stay.
+    template <typename Send> void flush(Send &&trySend)
+    {
+        for (auto held = m_held.begin(); held != m_held.end();)
+        {
+            if (!trySend(held->message))
+            {
+                ++held;
+                continue;
+            }
+            m_topics.erase(held->topic);
+            held = m_held.erase(held);
+        }
+    }
+
+    bool pending() const
+    {
+        return !m_held.empty();
+    }
+
+    std::chrono::milliseconds retry() const
+    {
+        return std::chrono::milliseconds(m_settings.retry);
+    }
+
+  private:
+    struct Held
+    {
+        std::string topic;
+        Multipart message;
+    };
+
+    bool conflatable(const zmq::message_t &topic) const
+    {
+        const std::string_view name = topic.to_string_view();
+        return std::any_of(m_settings.topics.begin(), m_settings.topics.end(),
+                           [name](const std::string &prefix) { return name.starts_with(prefix); });
+    }
+
+    ConflateSettings m_settings;
+    BrokerMetrics &m_metrics;
+    // Oldest first; only touched while a subscriber lags.
+    std::list<Held> m_held;
+    std::unordered_map<std::string_view, std::list<Held>::iterator> m_topics;
+};
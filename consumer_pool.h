@@ -0,0 +1,370 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "Poco/Environment.h"
+#include "Poco/ErrorHandler.h"
+#include "Poco/Event.h"
+#include "Poco/Exception.h"
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+#include "Poco/Util/AbstractConfiguration.h"
+
+#include "mpmc_queue.h"
+#include "thread_placement.h"
+
+struct ConsumerPoolSettings
+{
+    // Worker threads, 0 for one per processor.
+    size_t workers = 0;
+    // Keep items with the same key in submission order: keyed items always
+    // go to the key's worker and are never stolen.
+    bool ordered = false;
+    // Capacity of each worker's queue(s); submit() blocks while it is full.
+    size_t queueCapacity = 1024;
+    // Items handed to the handler at once.
+    size_t batch = 64;
+
+    static ConsumerPoolSettings fromConfig(const Poco::Util::AbstractConfiguration &config)
+    {
+        ConsumerPoolSettings settings;
+        settings.workers = std::max(0, config.getInt("consumers.workers", static_cast<int>(settings.workers)));
+        settings.ordered = config.getBool("consumers.ordered", settings.ordered);
+        settings.queueCapacity =
+            std::max(2, config.getInt("consumers.queue_capacity", static_cast<int>(settings.queueCapacity)));
+        settings.batch = std::max(1, config.getInt("consumers.batch", static_cast<int>(settings.batch)));
+        if (settings.workers == 0)
+        {
+            settings.workers = std::max(1u, Poco::Environment::processorCount());
+        }
+        return settings;
+    }
+};
+
+// Runs a batch handler on a pool of worker threads. Each worker owns a local
+// queue that submit() fills round-robin; a worker whose queues are empty
+// steals up to half a batch from the others, spins, and then sleeps until
+// it is woken: by a submit to its own queues, by a submit to a busy worker,
+// or by a worker that stole and left more behind. In ordered mode an item
+// submitted with a key goes to a second, never-stolen queue on the worker
+// the key hashes to, so the items of one key are handled one batch after
+// another by one thread; items without a key are spread as usual.
+//
+// The handler is called concurrently from all workers.
+template <typename T> class ConsumerPool
+{
+  public:
+    using Handler = std::function<void(std::span<T>)>;
+
+    struct WorkerStats
+    {
+        uint64_t handled;
+        uint64_t stolen;
+    };
+
+    explicit ConsumerPool(Handler handler) : m_handler(std::move(handler))
+    {
+    }
+
+    ~ConsumerPool()
+    {
+        stop();
+    }
+
+    ConsumerPool(const ConsumerPool &) = delete;
+    ConsumerPool &operator=(const ConsumerPool &) = delete;
+
+    // A pool is started once; stats() stays available after stop().
+    void start(const ConsumerPoolSettings &settings)
+    {
+        if (!m_workers.empty())
+        {
+            return;
+        }
+        m_settings = settings;
+        m_stopping = false;
+        for (size_t i = 0; i < settings.workers; ++i)
+        {
+            m_workers.emplace_back(new Worker(*this, i));
+        }
+        for (std::unique_ptr<Worker> &worker : m_workers)
+        {
+            worker->start();
+        }
+    }
+
+    // Lets the workers finish what is queued, then joins them. Items must
+    // not be submitted once stop() has been called.
+    void stop()
+    {
+        if (m_workers.empty() || m_stopping.exchange(true))
+        {
+            return;
+        }
+        for (std::unique_ptr<Worker> &worker : m_workers)
+        {
+            worker->wake();
+        }
+        for (std::unique_ptr<Worker> &worker : m_workers)
+        {
+            worker->join();
+        }
+    }
+
+    bool ordered() const
+    {
+        return m_settings.ordered;
+    }
+
+    // Throws Poco::IllegalStateException before start().
+    void submit(T &&item)
+    {
+        enqueue(std::move(item), false, 0);
+    }
+
+    // `key` only matters in ordered mode.
+    void submit(T &&item, uint64_t key)
+    {
+        enqueue(std::move(item), m_settings.ordered, key);
+    }
+
+    std::vector<WorkerStats> stats() const
+    {
+        std::vector<WorkerStats> stats;
+        for (const std::unique_ptr<Worker> &worker : m_workers)
+        {
+            stats.push_back({worker->m_handled.load(std::memory_order_relaxed),
+                             worker->m_stolen.load(std::memory_order_relaxed)});
+        }
+        return stats;
+    }
+
+  private:
+    void enqueue(T &&item, bool keyed, uint64_t key)
+    {
+        const size_t count = m_workers.size();
+        if (count == 0)
+        {
+            throw Poco::IllegalStateException("ConsumerPool::submit", "pool not started");
+        }
+        const size_t target = keyed ? static_cast<size_t>(mix(key) % count)
+                                    : m_next.fetch_add(1, std::memory_order_relaxed) % count;
+        Worker &worker = *m_workers[target];
+        (keyed ? *worker.m_ordered : worker.m_local).enqueue(std::move(item));
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (worker.m_sleeping.load(std::memory_order_relaxed))
+        {
+            worker.wake();
+        }
+        else if (!keyed && m_sleepers.load(std::memory_order_relaxed) != 0)
+        {
+            // The target is busy; let an idle worker steal the item.
+            wakeOneSleeper();
+        }
+    }
+
+    class Worker : public Poco::Runnable
+    {
+      public:
+        Worker(ConsumerPool &pool, size_t index)
+            : m_pool(pool), m_index(index), m_local(pool.m_settings.queueCapacity),
+              m_thread("consumer-" + std::to_string(index))
+        {
+            if (pool.m_settings.ordered)
+            {
+                m_ordered.reset(new MpmcQueue<T>(pool.m_settings.queueCapacity));
+            }
+        }
+
+        void start()
+        {
+            m_thread.start(*this);
+        }
+
+        void join()
+        {
+            m_thread.join();
+        }
+
+        void wake()
+        {
+            m_wakeup.set();
+        }
+
+        void run() override
+        {
+            ThreadPlacement::apply();
+            std::vector<T> batch(m_pool.m_settings.batch);
+            AdaptiveSpin spin;
+            for (;;)
+            {
+                // Read before looking for work, so anything submitted before
+                // stop() is seen by take() and handled before the worker quits.
+                const bool stopping = m_pool.m_stopping.load(std::memory_order_acquire);
+                size_t count = take(batch);
+                if (count == 0 && !stopping)
+                {
+                    count = spin.spin([&] { return take(batch); });
+                }
+
+                if (count != 0)
+                {
+                    handle(std::span<T>(batch.data(), count));
+                }
+                else if (stopping)
+                {
+                    break;
+                }
+                else
+                {
+                    sleep();
+                }
+            }
+        }
+
+      private:
+        friend class ConsumerPool;
+
+        // Own ordered items first, then own local items, then other workers'
+        // local items.
+        size_t take(std::vector<T> &batch)
+        {
+            size_t count = m_ordered ? m_ordered->tryDequeueBatch(batch) : 0;
+            if (count == 0)
+            {
+                count = m_local.tryDequeueBatch(batch);
+            }
+            if (count == 0)
+            {
+                count = steal(batch);
+            }
+            return count;
+        }
+
+        size_t steal(std::vector<T> &batch)
+        {
+            const size_t workers = m_pool.m_workers.size();
+            const std::span<T> half(batch.data(), std::max<size_t>(1, batch.size() / 2));
+            for (size_t i = 1; i < workers; ++i)
+            {
+                Worker &victim = *m_pool.m_workers[(m_index + i) % workers];
+                const size_t count = victim.m_local.tryDequeueBatch(half);
+                if (count != 0)
+                {
+                    m_stolen.store(m_stolen.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+                    if (!victim.m_local.empty() && m_pool.m_sleepers.load(std::memory_order_relaxed) != 0)
+                    {
+                        // Pass the rest on rather than leave it to the victim.
+                        m_pool.wakeOneSleeper();
+                    }
+                    return count;
+                }
+            }
+            return 0;
+        }
+
+        void handle(std::span<T> items)
+        {
+            try
+            {
+                m_pool.m_handler(items);
+            }
+            catch (const Poco::Exception &e)
+            {
+                Poco::ErrorHandler::handle(e);
+            }
+            catch (const std::exception &e)
+            {
+                Poco::ErrorHandler::handle(e);
+            }
+            catch (...)
+            {
+                Poco::ErrorHandler::handle();
+            }
+            // Release whatever the handler left behind.
+            for (T &item : items)
+            {
+                item = T();
+            }
+            m_handled.store(m_handled.load(std::memory_order_relaxed) + items.size(), std::memory_order_relaxed);
+        }
+
+        bool hasWork() const
+        {
+            if ((m_ordered && !m_ordered->empty()) || !m_local.empty())
+            {
+                return true;
+            }
+            for (const std::unique_ptr<Worker> &worker : m_pool.m_workers)
+            {
+                if (!worker->m_local.empty())
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void sleep()
+        {
+            m_sleeping.store(true, std::memory_order_relaxed);
+            m_pool.m_sleepers.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!hasWork() && !m_pool.m_stopping.load(std::memory_order_relaxed))
+            {
+                m_wakeup.wait();
+            }
+            m_pool.m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+            m_sleeping.store(false, std::memory_order_relaxed);
+        }
+
+        ConsumerPool &m_pool;
+        const size_t m_index;
+        MpmcQueue<T> m_local;
+        std::unique_ptr<MpmcQueue<T>> m_ordered;
+        std::atomic<bool> m_sleeping{false};
+        std::atomic<uint64_t> m_handled{0};
+        std::atomic<uint64_t> m_stolen{0};
+        Poco::Event m_wakeup;
+        Poco::Thread m_thread;
+    };
+
+    static uint64_t mix(uint64_t key)
+    {
+        // Spread sequential keys (fmix64 from MurmurHash3).
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ull;
+        key ^= key >> 33;
+        return key;
+    }
+
+    void wakeOneSleeper()
+    {
+        for (std::unique_ptr<Worker> &worker : m_workers)
+        {
+            if (worker->m_sleeping.load(std::memory_order_relaxed))
+            {
+                worker->wake();
+                return;
+            }
+        }
+    }
+
+    Handler m_handler;
+    ConsumerPoolSettings m_settings;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<size_t> m_next{0};
+    std::atomic<int> m_sleepers{0};
+    std::atomic<bool> m_stopping{false};
+};
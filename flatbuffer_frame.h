@@ -0,0 +1,285 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <flatbuffers/flatbuffers.h>
+#include <zmq.hpp>
+
+#include "mpmc_queue.h"
+
+// Thread-safe flatbuffers::Allocator for buffers that are handed to ZMQ. A
+// released buffer is freed by libzmq on one of its I/O threads once the
+// message is sent; it then goes back to a lock-free free list for its size
+// class (powers of two from 256 bytes to 16 MB) instead of to the heap, so a
+// steady stream of similar messages is encoded without allocating a buffer.
+// libzmq still allocates a small reference-count block for every frame it
+// is handed this way (zmq_msg_init_data).
+//
+// Each block starts with a header naming its allocator and size class, which
+// is what lets freeFrame() return a block given only its address.
+class RecyclingAllocator : public flatbuffers::Allocator
+{
+  public:
+    static constexpr unsigned kMinShift = 8;
+    static constexpr unsigned kClasses = 17;
+
+    struct Stats
+    {
+        uint64_t recycled;
+        uint64_t allocated;
+    };
+
+    explicit RecyclingAllocator(size_t blocksPerClass = 64)
+    {
+        for (std::unique_ptr<MpmcQueue<uint8_t *>> &free : m_free)
+        {
+            free.reset(new MpmcQueue<uint8_t *>(blocksPerClass));
+        }
+    }
+
+    ~RecyclingAllocator() override
+    {
+        for (std::unique_ptr<MpmcQueue<uint8_t *>> &free : m_free)
+        {
+            uint8_t *block;
+            while (free->tryDequeue(block))
+            {
+                delete[] block;
+            }
+        }
+    }
+
+    RecyclingAllocator(const RecyclingAllocator &) = delete;
+    RecyclingAllocator &operator=(const RecyclingAllocator &) = delete;
+
+    // Process-wide instance; outlives every ZMQ context in the program.
+    static RecyclingAllocator &shared()
+    {
+        static RecyclingAllocator allocator;
+        return allocator;
+    }
+
+    uint8_t *allocate(size_t size) override
+    {
+        const unsigned sizeClass = classFor(size + sizeof(Header));
+        uint8_t *block = nullptr;
+        if (sizeClass < kClasses && m_free[sizeClass]->tryDequeue(block))
+        {
+            m_recycled.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            m_allocated.fetch_add(1, std::memory_order_relaxed);
+            block = new uint8_t[sizeClass < kClasses ? classSize(sizeClass) : size + sizeof(Header)];
+        }
+        Header *header = reinterpret_cast<Header *>(block);
+        header->owner = this;
+        header->sizeClass = sizeClass;
+        return block + sizeof(Header);
+    }
+
+    void deallocate(uint8_t *p, size_t) override
+    {
+        uint8_t *block = p - sizeof(Header);
+        const unsigned sizeClass = reinterpret_cast<Header *>(block)->sizeClass;
+        if (sizeClass >= kClasses || !m_free[sizeClass]->tryEnqueue(std::move(block)))
+        {
+            delete[] block;
+        }
+    }
+
+    // zmq::message_t free callback for buffers from any RecyclingAllocator;
+    // `hint` is the buffer as returned by allocate().
+    static void freeFrame(void *, void *hint)
+    {
+        uint8_t *buffer = static_cast<uint8_t *>(hint);
+        reinterpret_cast<Header *>(buffer - sizeof(Header))->owner->deallocate(buffer, 0);
+    }
+
+    Stats stats() const
+    {
+        return {m_recycled.load(std::memory_order_relaxed), m_allocated.load(std::memory_order_relaxed)};
+    }
+
+  private:
+    // Keeps the buffer itself 16-byte aligned, as new[] returned it.
+    struct alignas(16) Header
+    {
+        RecyclingAllocator *owner;
+        unsigned sizeClass;
+    };
+
+    static unsigned classFor(size_t size)
+    {
+        unsigned sizeClass = 0;
+        while (sizeClass < kClasses && classSize(sizeClass) < size)
+        {
+            ++sizeClass;
+        }
+        return sizeClass;
+    }
+
+    static size_t classSize(unsigned sizeClass)
+    {
+        return size_t(1) << (sizeClass + kMinShift);
+    }
+
+    std::array<std::unique_ptr<MpmcQueue<uint8_t *>>, kClasses> m_free;
+    std::atomic<uint64_t> m_recycled{0};
+    std::atomic<uint64_t> m_allocated{0};
+};
+
+// Moves a finished builder's buffer into a ZMQ frame without copying it. The
+// builder must use a RecyclingAllocator; it is left cleared and ready for the
+// next message.
+//
+//   flatbuffers::FlatBufferBuilder builder(1024, &RecyclingAllocator::shared());
+//   builder.Finish(...);
+//   socket.send(releaseFrame(builder), zmq::send_flags::none);
+inline zmq::message_t releaseFrame(flatbuffers::FlatBufferBuilder &builder)
+{
+    size_t size;
+    size_t offset;
+    uint8_t *buffer = builder.ReleaseRaw(size, offset);
+    return zmq::message_t(buffer + offset, size - offset, &RecyclingAllocator::freeFrame, buffer);
+}
+
+// Same for a buffer already detached from its builder. Its allocator must be
+// safe to call from a libzmq I/O thread (the default allocator is).
+inline zmq::message_t detachedFrame(flatbuffers::DetachedBuffer &&buffer)
+{
+    flatbuffers::DetachedBuffer *owned = new flatbuffers::DetachedBuffer(std::move(buffer));
+    return zmq::message_t(
+        owned->data(), owned->size(), [](void *, void *hint) { delete static_cast<flatbuffers::DetachedBuffer *>(hint); },
+        owned);
+}
+
+// Typed access to a FlatBuffer received in a ZMQ frame, reading the frame's
+// memory in place when it is aligned for FlatBuffers. A frame may well not
+// be: libzmq keeps frames of up to 33 bytes inside the message object, and
+// its TCP decoder hands out frames of up to about 8 KB as slices of its
+// receive buffer at any offset. Such a frame is copied, into the view itself
+// if it is small, otherwise into a buffer the thread keeps for reuse; this is
+// why a view can be neither copied nor moved.
+//
+//   FlatBufferView<MyGame::Monster> monster(frame);
+//   if (monster)
+//       use(monster->name());
+template <typename T> class FlatBufferView
+{
+  public:
+    // The largest scalar alignment FlatBuffers needs.
+    static constexpr size_t kAlignment = 8;
+    static constexpr size_t kInlineBytes = 64;
+
+    explicit FlatBufferView(const zmq::message_t &frame, bool verify = true)
+    {
+        const flatbuffers::Verifier::Options options;
+        init(frame, verify ? &options : nullptr);
+    }
+
+    // Verifies with the given limits on depth, table count and so on.
+    FlatBufferView(const zmq::message_t &frame, const flatbuffers::Verifier::Options &options)
+    {
+        init(frame, &options);
+    }
+
+    ~FlatBufferView()
+    {
+        if (m_scratch.capacity() != 0)
+        {
+            std::vector<std::vector<uint64_t>> &spares = spareBuffers();
+            if (spares.size() < kSpareBuffers)
+            {
+                spares.push_back(std::move(m_scratch));
+            }
+        }
+    }
+
+    FlatBufferView(const FlatBufferView &) = delete;
+    FlatBufferView &operator=(const FlatBufferView &) = delete;
+
+    explicit operator bool() const
+    {
+        return m_root != nullptr;
+    }
+
+    const T *get() const
+    {
+        return m_root;
+    }
+
+    const T *operator->() const
+    {
+        return m_root;
+    }
+
+    // Whether the frame had to be copied for alignment.
+    bool copied() const
+    {
+        return m_copied;
+    }
+
+  private:
+    // Copy buffers a thread keeps between views, for views nested in others.
+    static constexpr size_t kSpareBuffers = 4;
+
+    static std::vector<std::vector<uint64_t>> &spareBuffers()
+    {
+        thread_local std::vector<std::vector<uint64_t>> spares;
+        return spares;
+    }
+
+    void init(const zmq::message_t &frame, const flatbuffers::Verifier::Options *options)
+    {
+        const uint8_t *data = static_cast<const uint8_t *>(frame.data());
+        const size_t size = frame.size();
+        if (reinterpret_cast<uintptr_t>(data) % kAlignment != 0)
+        {
+            data = copy(data, size);
+        }
+        if (size < sizeof(flatbuffers::uoffset_t))
+        {
+            return;
+        }
+        if (options)
+        {
+            flatbuffers::Verifier verifier(data, size, *options);
+            if (!verifier.VerifyBuffer<T>(nullptr))
+            {
+                return;
+            }
+        }
+        m_root = flatbuffers::GetRoot<T>(data);
+    }
+
+    const uint8_t *copy(const uint8_t *data, size_t size)
+    {
+        m_copied = true;
+        if (size <= kInlineBytes)
+        {
+            std::memcpy(m_inline, data, size);
+            return m_inline;
+        }
+        std::vector<std::vector<uint64_t>> &spares = spareBuffers();
+        if (!spares.empty())
+        {
+            m_scratch = std::move(spares.back());
+            spares.pop_back();
+        }
+        m_scratch.resize((size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+        std::memcpy(m_scratch.data(), data, size);
+        return reinterpret_cast<const uint8_t *>(m_scratch.data());
+    }
+
+    const T *m_root = nullptr;
+    bool m_copied = false;
+    alignas(kAlignment) uint8_t m_inline[kInlineBytes];
+    std::vector<uint64_t> m_scratch;
+};
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <flatbuffers/flatbuffers.h>
+
+// flatbuffers::Allocator that keeps one block for a single builder and hands
+// it out again after the builder frees it, so a builder that is Reset() or
+// recreated does not go back to the heap. The block only changes when a
+// message outgrows it; heapAllocations() counts those times.
+class ArenaAllocator : public flatbuffers::Allocator
+{
+  public:
+    explicit ArenaAllocator(size_t capacity) : m_capacity(roundUp(capacity))
+    {
+    }
+
+    ~ArenaAllocator() override
+    {
+        delete[] m_block;
+    }
+
+    ArenaAllocator(const ArenaAllocator &) = delete;
+    ArenaAllocator &operator=(const ArenaAllocator &) = delete;
+
+    uint8_t *allocate(size_t size) override
+    {
+        if (m_inUse)
+        {
+            // A second buffer at once; not something one builder does.
+            ++m_heapAllocations;
+            return new uint8_t[size];
+        }
+        if (m_block == nullptr || size > m_capacity)
+        {
+            replaceBlock(size);
+        }
+        m_inUse = true;
+        return m_block;
+    }
+
+    void deallocate(uint8_t *p, size_t) override
+    {
+        if (p == m_block)
+        {
+            m_inUse = false;
+        }
+        else
+        {
+            delete[] p;
+        }
+    }
+
+    uint8_t *reallocate_downward(uint8_t *old_p, size_t old_size, size_t new_size, size_t in_use_back,
+                                 size_t in_use_front) override
+    {
+        if (old_p != m_block)
+        {
+            return flatbuffers::Allocator::reallocate_downward(old_p, old_size, new_size, in_use_back, in_use_front);
+        }
+        // The builder grows from the back; keep both used ends in the new block.
+        std::unique_ptr<uint8_t[]> old(m_block);
+        m_block = nullptr;
+        replaceBlock(new_size);
+        memcpy_downward(old.get(), old_size, m_block, new_size, in_use_back, in_use_front);
+        return m_block;
+    }
+
+    // Drops the block if it is not in use, e.g. after messages got smaller.
+    void shrink(size_t capacity)
+    {
+        if (!m_inUse)
+        {
+            delete[] m_block;
+            m_block = nullptr;
+            m_capacity = roundUp(capacity);
+        }
+    }
+
+    size_t capacity() const
+    {
+        return m_capacity;
+    }
+
+    uint64_t heapAllocations() const
+    {
+        return m_heapAllocations;
+    }
+
+  private:
+    static size_t roundUp(size_t size)
+    {
+        size_t rounded = 256;
+        while (rounded < size)
+        {
+            rounded <<= 1;
+        }
+        return rounded;
+    }
+
+    void replaceBlock(size_t size)
+    {
+        delete[] m_block;
+        m_capacity = std::max(m_capacity, roundUp(size));
+        m_block = new uint8_t[m_capacity];
+        ++m_heapAllocations;
+    }
+
+    uint8_t *m_block = nullptr;
+    size_t m_capacity;
+    bool m_inUse = false;
+    uint64_t m_heapAllocations = 0;
+};
+
+// Per-thread pool of FlatBufferBuilders. acquire() leases a builder that is
+// Clear()ed when the lease ends and reused by the next acquire() on the same
+// thread, so its buffer (and vtable scratch space) is kept between messages.
+// Each builder draws from its own ArenaAllocator, whose block starts at the
+// largest message size seen so far and is shrunk back if messages stay much
+// smaller for a while. A lease must end on the thread that acquired it.
+//
+//   FlatBufferBuilderPool::Lease lease = FlatBufferBuilderPool::local().acquire();
+//   flatbuffers::FlatBufferBuilder &builder = lease.builder();
+class FlatBufferBuilderPool
+{
+    struct Slot;
+
+  public:
+    static constexpr size_t kInitialSize = 1024;
+    // Leases of one builder after which its block is shrunk if every message
+    // in that window used less than a quarter of it.
+    static constexpr uint32_t kShrinkWindow = 4096;
+
+    struct Stats
+    {
+        uint64_t leases;
+        uint64_t heapAllocations;
+        size_t largestMessage;
+        size_t builders;
+    };
+
+    class Lease
+    {
+      public:
+        Lease(Lease &&other) noexcept : m_pool(other.m_pool), m_slot(other.m_slot)
+        {
+            other.m_slot = nullptr;
+        }
+
+        Lease(const Lease &) = delete;
+        Lease &operator=(const Lease &) = delete;
+        Lease &operator=(Lease &&) = delete;
+
+        ~Lease()
+        {
+            if (m_slot)
+            {
+                m_pool.release(*m_slot);
+            }
+        }
+
+        flatbuffers::FlatBufferBuilder &builder()
+        {
+            return m_slot->builder;
+        }
+
+        flatbuffers::FlatBufferBuilder *operator->()
+        {
+            return &m_slot->builder;
+        }
+
+      private:
+        friend class FlatBufferBuilderPool;
+
+        Lease(FlatBufferBuilderPool &pool, Slot &slot) : m_pool(pool), m_slot(&slot)
+        {
+        }
+
+        FlatBufferBuilderPool &m_pool;
+        Slot *m_slot;
+    };
+
+    // The calling thread's pool.
+    static FlatBufferBuilderPool &local()
+    {
+        thread_local FlatBufferBuilderPool pool;
+        return pool;
+    }
+
+    Lease acquire()
+    {
+        ++m_leases;
+        for (const std::unique_ptr<Slot> &slot : m_slots)
+        {
+            if (!slot->busy)
+            {
+                slot->busy = true;
+                return Lease(*this, *slot);
+            }
+        }
+        // The builder's scratch space shares the buffer, hence the headroom.
+        m_slots.emplace_back(new Slot(std::max(kInitialSize, 2 * m_largest)));
+        m_slots.back()->busy = true;
+        return Lease(*this, *m_slots.back());
+    }
+
+    Stats stats() const
+    {
+        uint64_t heapAllocations = 0;
+        for (const std::unique_ptr<Slot> &slot : m_slots)
+        {
+            heapAllocations += slot->allocator.heapAllocations();
+        }
+        return {m_leases, heapAllocations, m_largest, m_slots.size()};
+    }
+
+  private:
+    struct Slot
+    {
+        explicit Slot(size_t size) : allocator(size), builder(size, &allocator, false)
+        {
+        }
+
+        ArenaAllocator allocator;
+        flatbuffers::FlatBufferBuilder builder;
+        bool busy = false;
+        uint32_t window = 0;
+        size_t windowLargest = 0;
+    };
+
+    void release(Slot &slot)
+    {
+        const size_t size = slot.builder.GetSize();
+        m_largest = std::max(m_largest, size);
+        slot.windowLargest = std::max(slot.windowLargest, size);
+
+        if (++slot.window == kShrinkWindow)
+        {
+            if (slot.windowLargest * 4 < slot.allocator.capacity())
+            {
+                slot.builder.Reset();
+                slot.allocator.shrink(slot.windowLargest * 2);
+            }
+            m_largest = slot.windowLargest;
+            slot.window = 0;
+            slot.windowLargest = 0;
+        }
+
+        slot.builder.Clear();
+        slot.busy = false;
+    }
+
+    std::vector<std::unique_ptr<Slot>> m_slots;
+    uint64_t m_leases = 0;
+    size_t m_largest = 0;
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Poco/Exception.h"
+#include "Poco/StringTokenizer.h"
+#include "Poco/Util/AbstractConfiguration.h"
+
+#include <flatbuffers/flatbuffers.h>
+
+#include "broker_metrics.h"
+#include "monster_batch.h"
+#include "monster_generated.h"
+#include "zmq_forwarder.h"
+
+struct VerifySettings
+{
+    enum class Policy
+    {
+        Off,
+        Full,
+        Sampled
+    };
+
+    Policy policy = Policy::Off;
+    // Sampled policy: verify one message in `sampleEvery`.
+    uint32_t sampleEvery = 100;
+    // Frame holding the Monster; messages with fewer frames are rejected.
+    size_t frame = 1;
+    uint32_t maxDepth = 64;
+    uint32_t maxTables = 1000000;
+    // Topic prefixes to verify, all topics if empty.
+    std::vector<std::string> topics;
+
+    static VerifySettings fromConfig(const Poco::Util::AbstractConfiguration &config)
+    {
+        VerifySettings settings;
+        const std::string policy = config.getString("verify.policy", "off");
+        if (policy == "full")
+        {
+            settings.policy = Policy::Full;
+        }
+        else if (policy == "sampled")
+        {
+            settings.policy = Policy::Sampled;
+        }
+        else if (policy != "off")
+        {
+            throw Poco::InvalidArgumentException("verify.policy", policy);
+        }
+        settings.sampleEvery = std::max(1, config.getInt("verify.sample_every", settings.sampleEvery));
+        settings.frame = std::max(0, config.getInt("verify.frame", static_cast<int>(settings.frame)));
+        settings.maxDepth = std::max(1, config.getInt("verify.max_depth", settings.maxDepth));
+        settings.maxTables = std::max(1, config.getInt("verify.max_tables", settings.maxTables));
+
+        Poco::StringTokenizer topics(config.getString("verify.topics", ""), ",",
+                                     Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+        settings.topics.assign(topics.begin(), topics.end());
+        return settings;
+    }
+};
+
+// Ingress stage that checks Monster payloads with the generated verifier
+// (Monster::Verify, which covers the Any union through VerifyAny) before the
+// broker forwards them, and rejects those that fail. With the full policy
+// every message on a verified topic is checked, so subscribers of those
+// topics can read the payload with GetMonster() without verifying it
+// themselves; the sampled policy only detects and drops a share of bad
+// messages. Frames carrying the MonsterBatch identifier are verified as a
+// batch, Monster by Monster. Runs on the thread that owns `metrics`.
+class IngressVerifier
+{
+  public:
+    IngressVerifier(const VerifySettings &settings, BrokerMetrics &metrics, bool timed)
+        : m_settings(settings), m_metrics(metrics), m_timed(timed), m_seen(0)
+    {
+        m_options.max_depth = settings.maxDepth;
+        m_options.max_tables = settings.maxTables;
+        m_options.check_alignment = false;
+    }
+
+    // Returns false if the message must be dropped.
+    bool admit(const Multipart &message)
+    {
+        if (m_settings.policy == VerifySettings::Policy::Off || !selected(message.front()))
+        {
+            return true;
+        }
+        if (m_settings.policy == VerifySettings::Policy::Sampled && ++m_seen % m_settings.sampleEvery != 0)
+        {
+            return true;
+        }
+
+        const uint64_t start = m_timed ? monotonicNanos() : 0;
+        const bool valid = message.size() > m_settings.frame && verify(message[m_settings.frame]);
+        if (m_timed)
+        {
+            m_metrics.verifyLatency.record(monotonicNanos() - start);
+        }
+
+        bump(m_metrics.verified);
+        if (!valid)
+        {
+            bump(m_metrics.rejected);
+        }
+        return valid;
+    }
+
+  private:
+    bool selected(const zmq::message_t &topic) const
+    {
+        if (m_settings.topics.empty())
+        {
+            return true;
+        }
+        const std::string_view name = topic.to_string_view();
+        return std::any_of(m_settings.topics.begin(), m_settings.topics.end(),
+                           [name](const std::string &prefix) { return name.starts_with(prefix); });
+    }
+
+    // Verifies the frame where it is: frames from libzmq's TCP decoder sit at
+    // any offset, and with alignment checks off the verifier accepts them
+    // without a copy.
+    bool verify(const zmq::message_t &frame) const
+    {
+        flatbuffers::Verifier verifier(static_cast<const uint8_t *>(frame.data()), frame.size(), m_options);
+        return isMonsterBatch(frame) ? MyGame::VerifyMonsterBatchBuffer(verifier)
+                                     : MyGame::VerifyMonsterBuffer(verifier);
+    }
+
+    VerifySettings m_settings;
+    BrokerMetrics &m_metrics;
+    const bool m_timed;
+    flatbuffers::Verifier::Options m_options;
+    uint64_t m_seen;
+};
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Poco/Runnable.h"
+#include "Poco/StringTokenizer.h"
+#include "Poco/Thread.h"
+#include "Poco/Util/AbstractConfiguration.h"
+
+#include <zmq.hpp>
+
+#include "broker_metrics.h"
+#include "consumer_pool.h"
+#include "notification_pool.h"
+#include "thread_placement.h"
+#include "zmq_forwarder.h"
+
+struct BridgeSettings
+{
+    bool enabled = false;
+    // inproc endpoint XPUB also binds, in the broker's context.
+    std::string endpoint = "inproc://pocoex-broker";
+    // Topic prefixes the bridge subscribes to, all topics if empty.
+    std::vector<std::string> topics;
+
+    static BridgeSettings fromConfig(const Poco::Util::AbstractConfiguration &config)
+    {
+        BridgeSettings settings;
+        settings.enabled = config.getBool("bridge.enable", settings.enabled);
+        settings.endpoint = config.getString("bridge.endpoint", settings.endpoint);
+        Poco::StringTokenizer topics(config.getString("bridge.topics", ""), ",",
+                                     Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+        settings.topics.assign(topics.begin(), topics.end());
+        if (settings.topics.empty())
+        {
+            settings.topics.emplace_back();
+        }
+        return settings;
+    }
+};
+
+// Subscribes to the broker over inproc and hands every message to a consumer
+// pool as a pooled notification whose payload's `frames` (a
+// std::vector<zmq::message_t>, topic first) are the received frames. Over
+// inproc libzmq passes messages between threads by reference, and XPUB
+// shares one refcounted buffer among all its subscribers, so a frame
+// reaches a consumer without being copied and without a system call. The
+// broker's buffer is released when the last consumer drops the frame: a
+// handler clears `frames` once it is done with them, and the bridge clears
+// them as it reuses a notification.
+//
+// The bridge is an ordinary subscriber: its subscriptions reach the
+// publishers, the last-value cache replays to it, and while the consumer
+// pool is full it stops reading, its SUB fills up and XPUB treats it like any
+// slow subscriber. Messages are submitted keyed by topic, so with
+// consumers.ordered each topic is handled in order. It shares XPUB with the
+// tcp subscribers, so it cannot be used with compress.enable, which would
+// hand it compressed frames.
+//
+// Start it after the consumer pool and stop it before, as nothing may be
+// submitted to a stopped pool.
+template <typename Payload> class InprocBridge : public Poco::Runnable
+{
+  public:
+    using Pool = NotificationPool<Payload>;
+    using Consumers = ConsumerPool<typename Pool::Ptr>;
+
+    InprocBridge(const BridgeSettings &settings, Pool &pool, Consumers &consumers)
+        : m_settings(settings), m_pool(pool), m_consumers(consumers), m_context(nullptr), m_controlEndpoint{},
+          m_sub{}, m_control{}, m_thread{"bridge"}
+    {
+    }
+
+    ~InprocBridge()
+    {
+        stop();
+    }
+
+    InprocBridge(const InprocBridge &) = delete;
+    InprocBridge &operator=(const InprocBridge &) = delete;
+
+    // `context` must be the one the broker's XPUB lives in.
+    void start(zmq::context_t &context)
+    {
+        if (!m_settings.enabled || m_thread.isRunning())
+        {
+            return;
+        }
+        m_context = &context;
+        m_controlEndpoint = m_settings.endpoint + "-bridge-control";
+
+        m_sub = zmq::socket_t(context, ZMQ_SUB);
+        m_sub.set(zmq::sockopt::linger, 0);
+        for (const std::string &topic : m_settings.topics)
+        {
+            m_sub.set(zmq::sockopt::subscribe, topic);
+        }
+        m_sub.connect(m_settings.endpoint);
+        m_control = zmq::socket_t(context, ZMQ_PAIR);
+        m_control.bind(m_controlEndpoint);
+
+        m_thread.start(*this);
+    }
+
+    void stop()
+    {
+        if (m_thread.isRunning())
+        {
+            signalEndpoint(*m_context, m_controlEndpoint, "STOP");
+            m_thread.join();
+        }
+    }
+
+    void run() override
+    {
+        ThreadPlacement::apply();
+        zmq::pollitem_t items[] = {{m_sub.handle(), 0, ZMQ_POLLIN, 0}, {m_control.handle(), 0, ZMQ_POLLIN, 0}};
+        bool running = true;
+        while (running)
+        {
+            zmq::poll(items, 2, std::chrono::milliseconds(-1));
+            running = !(items[1].revents & ZMQ_POLLIN);
+            for (size_t n = 0; running && n < ZmqProxy::kBatch; ++n)
+            {
+                if (!receive())
+                {
+                    break;
+                }
+            }
+        }
+        m_sub.close();
+        m_control.close();
+    }
+
+    uint64_t received() const
+    {
+        return m_received.load(std::memory_order_relaxed);
+    }
+
+    uint64_t bytes() const
+    {
+        return m_bytes.load(std::memory_order_relaxed);
+    }
+
+  private:
+    // Reads one message if there is one and submits it.
+    bool receive()
+    {
+        zmq::message_t topic;
+        if (!m_sub.recv(topic, zmq::recv_flags::dontwait))
+        {
+            return false;
+        }
+        typename Pool::Ptr notification = m_pool.acquire();
+        std::vector<zmq::message_t> &frames = notification->payload().frames;
+        frames.clear();
+        frames.push_back(std::move(topic));
+        size_t bytes = frames.back().size();
+        while (frames.back().more())
+        {
+            frames.emplace_back();
+            if (!m_sub.recv(frames.back(), zmq::recv_flags::none))
+            {
+                return false;
+            }
+            bytes += frames.back().size();
+        }
+
+        bump(m_received);
+        bump(m_bytes, bytes);
+        const uint64_t key = topicHash(frames.front());
+        m_consumers.submit(std::move(notification), key);
+        return true;
+    }
+
+    BridgeSettings m_settings;
+    Pool &m_pool;
+    Consumers &m_consumers;
+    zmq::context_t *m_context;
+    std::string m_controlEndpoint;
+    zmq::socket_t m_sub;
+    zmq::socket_t m_control;
+    std::atomic<uint64_t> m_received{0};
+    std::atomic<uint64_t> m_bytes{0};
+    Poco::Thread m_thread;
+};
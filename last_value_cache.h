@@ -0,0 +1,389 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "Poco/Util/AbstractConfiguration.h"
+
+#include <zmq.hpp>
+
+#include "zmq_forwarder.h"
+
+struct LastValueSettings
+{
+    bool enabled = false;
+    // Topics kept; beyond it the least recently updated topic is evicted.
+    size_t maxTopics = 65536;
+    // Bytes of cached messages, all frames counted; evicts the same way.
+    size_t maxBytes = size_t(64) << 20;
+
+    static LastValueSettings fromConfig(const Poco::Util::AbstractConfiguration &config)
+    {
+        LastValueSettings settings;
+        settings.enabled = config.getBool("lvc.enable", settings.enabled);
+        settings.maxTopics = std::max(1, config.getInt("lvc.max_topics", static_cast<int>(settings.maxTopics)));
+        settings.maxBytes = static_cast<size_t>(
+            std::max(Poco::Int64(0), config.getInt64("lvc.max_bytes", static_cast<Poco::Int64>(settings.maxBytes))));
+        return settings;
+    }
+};
+
+// Keeps the latest message of every topic the broker forwards and sends a
+// new subscriber to a topic its cached message, so a late joiner gets the
+// current state without waiting for the publisher to send again. Runs on the
+// thread that owns XPUB: stage() just before a message goes to XPUB, commit()
+// once XPUB has taken it, so only delivered messages are cached, and
+// subscription() for every subscription message read from it.
+//
+// Topics live in an open-addressing table of 8-byte slots, kept at most half
+// full, pointing into a dense array of entries that also form a
+// least-recently-updated list for eviction. Entries hold references to the
+// forwarded frames (zmq_msg_copy), not copies of the payload.
+//
+// Replies go to the new subscriber only through ZMQ_XPUB_MANUAL_LAST_VALUE, a
+// libzmq draft option; without it a replay would be published to every
+// subscriber of the topic, so the cache stays off (see available()). XPUB
+// runs in manual mode and the cache applies subscriptions itself. libzmq
+// sends one message per subscription to the new subscriber alone, so only a
+// subscription to exactly a cached topic is answered: a prefix subscription
+// covering several topics gets nothing replayed.
+class LastValueCache
+{
+  public:
+    explicit LastValueCache(const LastValueSettings &settings)
+        : m_settings(settings), m_slots{}, m_entries{}, m_staged{}, m_bytes(0), m_oldest(kNil), m_newest(kNil),
+          m_replayed(0), m_refused(0), m_evicted(0)
+    {
+        m_settings.enabled = settings.enabled && available();
+        m_slots.resize(m_settings.enabled ? slotsFor(settings.maxTopics) : 0);
+    }
+
+    // Whether libzmq can send to one subscriber, which the cache needs.
+    static bool available()
+    {
+#ifdef ZMQ_XPUB_MANUAL_LAST_VALUE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool enabled() const
+    {
+        return m_settings.enabled;
+    }
+
+    LastValueCache(const LastValueCache &) = delete;
+    LastValueCache &operator=(const LastValueCache &) = delete;
+
+    // Sets the XPUB options the cache relies on, before the socket binds.
+    void prepare(zmq::socket_t &xpub) const
+    {
+#ifdef ZMQ_XPUB_MANUAL_LAST_VALUE
+        if (m_settings.enabled)
+        {
+            xpub.set(zmq::sockopt::xpub_manual, 1);
+        }
+#else
+        (void)xpub;
+#endif
+    }
+
+    // Takes references to the frames of a message about to be sent to XPUB,
+    // as sending empties it; the payload itself is not copied.
+    void stage(Multipart &message)
+    {
+        if (!m_settings.enabled)
+        {
+            return;
+        }
+        m_staged.resize(message.size());
+        for (size_t i = 0; i < message.size(); ++i)
+        {
+            m_staged[i].copy(message[i]);
+        }
+    }
+
+    // Caches the staged message, once XPUB has taken it.
+    void commit()
+    {
+        if (!m_settings.enabled || m_staged.empty())
+        {
+            return;
+        }
+        size_t bytes = 0;
+        for (const zmq::message_t &frame : m_staged)
+        {
+            bytes += frame.size();
+        }
+        const zmq::message_t &topic = m_staged.front();
+        const uint64_t hash = topicHash(topic);
+        const size_t slot = find(hash, topic);
+        uint32_t index = m_slots[slot].entry;
+        if (index == kNil)
+        {
+            if (bytes > m_settings.maxBytes)
+            {
+                m_staged.clear();
+                return;
+            }
+            index = static_cast<uint32_t>(m_entries.size());
+            m_entries.emplace_back();
+            m_entries[index].hash = hash;
+            m_slots[slot] = {static_cast<uint32_t>(hash >> 32), index};
+        }
+        else
+        {
+            m_bytes -= m_entries[index].bytes;
+            unlink(index);
+        }
+
+        Entry &entry = m_entries[index];
+        std::swap(entry.frames, m_staged);
+        m_staged.clear();
+        entry.bytes = bytes;
+        m_bytes += entry.bytes;
+        linkNewest(index);
+
+        while (!m_entries.empty() && (m_entries.size() > m_settings.maxTopics || m_bytes > m_settings.maxBytes))
+        {
+            evict(m_oldest);
+        }
+    }
+
+    // Handles a subscription message read from XPUB: applies it to XPUB, and
+    // answers a subscription to a cached topic with its message.
+    void subscription(zmq::socket_t &xpub, const zmq::message_t &frame)
+    {
+        if (!m_settings.enabled || frame.size() == 0)
+        {
+            return;
+        }
+#ifdef ZMQ_XPUB_MANUAL_LAST_VALUE
+        const char *data = static_cast<const char *>(frame.data());
+        const std::string_view topic(data + 1, frame.size() - 1);
+        if (data[0] == 1)
+        {
+            xpub.set(zmq::sockopt::subscribe, topic);
+            replay(xpub, topic);
+        }
+        else if (data[0] == 0)
+        {
+            xpub.set(zmq::sockopt::unsubscribe, topic);
+        }
+#else
+        (void)xpub;
+#endif
+    }
+
+    // Whether a message of `topic` is cached.
+    bool contains(std::string_view topic) const
+    {
+        return m_settings.enabled && m_slots[find(topicHash(topic), topic)].entry != kNil;
+    }
+
+    size_t topics() const
+    {
+        return m_entries.size();
+    }
+
+    size_t bytes() const
+    {
+        return m_bytes;
+    }
+
+    // Cached messages sent to new subscribers.
+    uint64_t replayed() const
+    {
+        return m_replayed;
+    }
+
+    // Cached messages XPUB refused to take (see broker.xpub_nodrop).
+    uint64_t refused() const
+    {
+        return m_refused;
+    }
+
+    uint64_t evicted() const
+    {
+        return m_evicted;
+    }
+
+  private:
+    static constexpr uint32_t kNil = UINT32_MAX;
+
+    // `tag` is the top half of the topic hash, checked before the entry.
+    struct Slot
+    {
+        uint32_t tag = 0;
+        uint32_t entry = kNil;
+    };
+
+    struct Entry
+    {
+        uint64_t hash = 0;
+        // All frames of the message, the topic first.
+        std::vector<zmq::message_t> frames;
+        size_t bytes = 0;
+        uint32_t older = kNil;
+        uint32_t newer = kNil;
+    };
+
+    static size_t slotsFor(size_t topics)
+    {
+        size_t slots = 16;
+        while (slots < topics * 2)
+        {
+            slots *= 2;
+        }
+        return slots;
+    }
+
+    size_t mask() const
+    {
+        return m_slots.size() - 1;
+    }
+
+    // The slot holding `topic`, or the empty slot where it belongs.
+    size_t find(uint64_t hash, const zmq::message_t &topic) const
+    {
+        return find(hash, std::string_view(static_cast<const char *>(topic.data()), topic.size()));
+    }
+
+    size_t find(uint64_t hash, std::string_view topic) const
+    {
+        const uint32_t tag = static_cast<uint32_t>(hash >> 32);
+        for (size_t i = hash & mask();; i = (i + 1) & mask())
+        {
+            const Slot &slot = m_slots[i];
+            if (slot.entry == kNil)
+            {
+                return i;
+            }
+            if (slot.tag == tag)
+            {
+                const zmq::message_t &key = m_entries[slot.entry].frames.front();
+                if (key.size() == topic.size() && std::memcmp(key.data(), topic.data(), topic.size()) == 0)
+                {
+                    return i;
+                }
+            }
+        }
+    }
+
+    size_t slotOf(uint32_t index) const
+    {
+        size_t i = m_entries[index].hash & mask();
+        while (m_slots[i].entry != index)
+        {
+            i = (i + 1) & mask();
+        }
+        return i;
+    }
+
+    // Backward-shift deletion: moves later slots of the probe run into the
+    // hole, so lookups never need tombstones.
+    void eraseSlot(size_t hole)
+    {
+        for (size_t i = (hole + 1) & mask(); m_slots[i].entry != kNil; i = (i + 1) & mask())
+        {
+            const size_t home = m_entries[m_slots[i].entry].hash & mask();
+            if (((i - home) & mask()) >= ((i - hole) & mask()))
+            {
+                m_slots[hole] = m_slots[i];
+                hole = i;
+            }
+        }
+        m_slots[hole] = Slot{};
+    }
+
+    void unlink(uint32_t index)
+    {
+        Entry &entry = m_entries[index];
+        (entry.older == kNil ? m_oldest : m_entries[entry.older].newer) = entry.newer;
+        (entry.newer == kNil ? m_newest : m_entries[entry.newer].older) = entry.older;
+        entry.older = entry.newer = kNil;
+    }
+
+    void linkNewest(uint32_t index)
+    {
+        Entry &entry = m_entries[index];
+        entry.older = m_newest;
+        entry.newer = kNil;
+        (m_newest == kNil ? m_oldest : m_entries[m_newest].newer) = index;
+        m_newest = index;
+    }
+
+    // Removes an entry and moves the last one into its place.
+    void evict(uint32_t index)
+    {
+        eraseSlot(slotOf(index));
+        unlink(index);
+        m_bytes -= m_entries[index].bytes;
+        ++m_evicted;
+
+        const uint32_t last = static_cast<uint32_t>(m_entries.size() - 1);
+        if (index != last)
+        {
+            m_slots[slotOf(last)].entry = index;
+            Entry &moved = m_entries[last];
+            (moved.older == kNil ? m_oldest : m_entries[moved.older].newer) = index;
+            (moved.newer == kNil ? m_newest : m_entries[moved.newer].older) = index;
+            m_entries[index] = std::move(moved);
+        }
+        m_entries.pop_back();
+    }
+
+#ifdef ZMQ_XPUB_MANUAL_LAST_VALUE
+    // Sends the cached message of `topic`, if there is one, to the subscriber
+    // that sent the last subscription only.
+    void replay(zmq::socket_t &xpub, std::string_view topic)
+    {
+        const uint32_t index = m_slots[find(topicHash(topic), topic)].entry;
+        if (index == kNil)
+        {
+            return;
+        }
+        xpub.set(zmq::sockopt::xpub_manual_last_value, 1);
+        const bool sent = send(xpub, m_entries[index]);
+        // Last-value mode stays on until it is cleared, and would send every
+        // later message to the pipe of the last subscription only, whichever
+        // that is. Clearing it also clears manual mode, so set that again.
+        xpub.set(zmq::sockopt::xpub_manual_last_value, 0);
+        xpub.set(zmq::sockopt::xpub_manual, 1);
+        ++(sent ? m_replayed : m_refused);
+    }
+#endif
+
+    // Never waits: a slow new subscriber must not stall the broker.
+    static bool send(zmq::socket_t &xpub, Entry &entry)
+    {
+        for (size_t i = 0; i < entry.frames.size(); ++i)
+        {
+            zmq::message_t frame;
+            frame.copy(entry.frames[i]);
+            const bool last = i + 1 == entry.frames.size();
+            if (!xpub.send(frame, last ? zmq::send_flags::dontwait
+                                       : zmq::send_flags::sndmore | zmq::send_flags::dontwait))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    LastValueSettings m_settings;
+    std::vector<Slot> m_slots;
+    std::vector<Entry> m_entries;
+    // The message stage() took, until commit().
+    std::vector<zmq::message_t> m_staged;
+    size_t m_bytes;
+    uint32_t m_oldest;
+    uint32_t m_newest;
+    uint64_t m_replayed;
+    uint64_t m_refused;
+    uint64_t m_evicted;
+};
@@ -1,16 +1,22 @@
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <span>
+#include <vector>
 
+#include "Poco/AutoPtr.h"
 #include "Poco/DateTime.h"
 #include "Poco/DateTimeFormat.h"
 #include "Poco/DateTimeFormatter.h"
 #include "Poco/DateTimeParser.h"
 #include "Poco/Environment.h"
+#include "Poco/Exception.h"
 #include "Poco/LocalDateTime.h"
-#include "Poco/Notification.h"
-#include "Poco/NotificationQueue.h"
 #include "Poco/Task.h"
 #include "Poco/TaskManager.h"
+#include "Poco/Util/AbstractConfiguration.h"
 #include "Poco/Util/HelpFormatter.h"
 #include "Poco/Util/Option.h"
 #include "Poco/Util/OptionSet.h"
@@ -23,6 +29,25 @@
 
 #include <zmq.hpp>
 
+#include "async_logger.h"
+#include "broker_metrics.h"
+#include "capture_log.h"
+#include "conflator.h"
+#include "consumer_pool.h"
+#include "flatbuffer_frame.h"
+#include "flatbuffer_pool.h"
+#include "ingress_verifier.h"
+#include "inproc_bridge.h"
+#include "last_value_cache.h"
+#include "message_dispatch.h"
+#include "message_interceptor.h"
+#include "monster_batch.h"
+#include "mpmc_queue.h"
+#include "notification_pool.h"
+#include "payload_compression.h"
+#include "thread_placement.h"
+#include "zmq_forwarder.h"
+
 #include "monster_generated.h"
 #include <flatbuffers/flatbuffers.h>
 
@@ -33,8 +58,6 @@ using Poco::DateTimeParser;
 using Poco::LocalDateTime;
 
 using Poco::DateTimeFormatter;
-using Poco::Notification;
-using Poco::NotificationQueue;
 using Poco::Task;
 using Poco::TaskManager;
 using Poco::Util::Application;
@@ -49,68 +72,117 @@ using Poco::Util::Subsystem;
 
 using Poco::Environment;
 
-class SampleNotification : public Notification
+struct SampleNotification
 {
-  public:
-    SampleNotification(const std::string &message) : _message(message)
-    {
-    }
-    const std::string &message() const
-    {
-        return _message;
-    }
-
-  private:
-    std::string _message;
+    std::string message;
+    // A message from the broker, topic first, when the inproc bridge
+    // (bridge.enable) sent it; the frames share the broker's buffers.
+    std::vector<zmq::message_t> frames;
 };
 
+// Notifications come from a pool and are returned to it by whichever thread
+// drops the last reference, so the producer/consumer path neither allocates
+// nor frees per message once the pool is warm.
+using SamplePool = NotificationPool<SampleNotification>;
+using SampleConsumers = ConsumerPool<SamplePool::Ptr>;
+
 class ProducerTask : public Task
 {
   public:
-    ProducerTask(NotificationQueue &queue) : Task("ProducerTask"), _queue(queue)
+    ProducerTask(SamplePool &pool, SampleConsumers &consumers)
+        : Task("ProducerTask"), _pool(pool), _consumers(consumers)
     {
     }
 
     void runTask() override
     {
+        // Runs on a TaskManager pool thread, which gets its affinity back after.
+        ScopedPlacement placement("producer");
         for (int i = 0; i < 10; ++i)
         {
-            std::string message = "Message " + std::to_string(i);
-            _queue.enqueueNotification(new SampleNotification(message));
+            SamplePool::Ptr notification = _pool.acquire();
+            std::string &message = notification->payload().message;
+            message.assign("Message ");
+            message.append(std::to_string(i));
+            // Left over if a handler failed on a bridged message.
+            notification->payload().frames.clear();
+            _consumers.submit(std::move(notification), i);
             sleep(1000);
         }
     }
 
   private:
-    NotificationQueue &_queue;
+    SamplePool &_pool;
+    SampleConsumers &_consumers;
 };
 
-class ConsumerTask : public Task
+// Reads the Monster or MonsterBatch in a bridged message's last frame in
+// place and reports what their `test` unions hold.
+void readMonsters(AsyncLogger &log, std::string_view topic, const zmq::message_t &payload)
 {
-  public:
-    ConsumerTask(NotificationQueue &queue) : Task("ConsumerTask"), _queue(queue)
+    uint64_t monsters = 0, weapons = 0, pickups = 0;
+    const auto count = [&](const MyGame::Monster &monster) {
+        ++monsters;
+        dispatchTest(monster, Overloaded{[&](const MyGame::Weapon &) { ++weapons; },
+                                         [&](const MyGame::Pickup &) { ++pickups; }});
+    };
+    if (isMonsterBatch(payload))
     {
+        const MonsterBatchView batch(payload);
+        for (const MyGame::Monster *monster : batch)
+        {
+            count(*monster);
+        }
     }
-
-    void runTask() override
+    else
     {
-        while (!isCancelled())
+        const FlatBufferView<MyGame::Monster> monster(payload);
+        if (monster)
         {
-            Poco::AutoPtr<Notification> pNf(_queue.waitDequeueNotification(3000));
-            if (pNf)
-            {
-                SampleNotification *pSampleNf = dynamic_cast<SampleNotification *>(pNf.get());
-                if (pSampleNf)
-                {
-                    Application::instance().logger().information("Received: " + pSampleNf->message());
-                }
-            }
+            count(*monster.get());
         }
     }
+    log.debug("Bridged: ", topic, ", ", monsters, " monsters, ", weapons, " weapons, ", pickups, " pickups");
+}
 
-  private:
-    NotificationQueue &_queue;
-};
+void ignoreBridged(AsyncLogger &, std::string_view, const zmq::message_t &)
+{
+}
+
+// Handlers for bridged messages by topic prefix, the more specific first:
+// the Monster streams of pocoex_bench and pocoex_replay, without the bench's
+// warm-up messages. Other topics are only logged.
+void consumeBridged(AsyncLogger &log, std::vector<zmq::message_t> &frames)
+{
+    static auto router = makeTopicRouter<"bench/warmup", "bench/", "replay/">(&ignoreBridged, &readMonsters,
+                                                                             &readMonsters);
+    const std::string_view topic = frames.front().to_string_view();
+    if (frames.size() < 2 || !router.dispatch(topic, log, topic, frames.back()))
+    {
+        log.debug("Bridged: ", topic, ", ", frames.size(), " frames");
+    }
+    // Hands the buffers back to the broker now rather than on reuse.
+    frames.clear();
+}
+
+// Runs on every consumer pool worker. The logger is looked up once, when the
+// pool's handler is built, rather than per batch.
+void consumeSamples(AsyncLogger &log, std::span<SamplePool::Ptr> notifications)
+{
+    for (SamplePool::Ptr &notification : notifications)
+    {
+        std::vector<zmq::message_t> &frames = notification->payload().frames;
+        if (frames.empty())
+        {
+            log.information("Received: ", notification->payload().message);
+        }
+        else
+        {
+            consumeBridged(log, frames);
+        }
+        notification.reset();
+    }
+}
 
 class SampleTask : public Task
 {
@@ -122,64 +194,691 @@ class SampleTask : public Task
     void runTask() override
     {
         Application &app = Application::instance();
+        AsyncLogger &log = app.getSubsystem<AsyncLogger>();
         while (!sleep(5000))
         {
             // app.logger().information("busy doing nothing... " + DateTimeFormatter::format(app.uptime()));
 
-            app.logger().information("application uptime: " + DateTimeFormatter::format(app.uptime()));
+            log.information("application uptime: ", app.uptime());
+        }
+    }
+};
+
+struct ZmqSettings
+{
+    enum class Engine
+    {
+        Forwarder,
+        Proxy
+    };
+
+    std::string frontend = "tcp://*:5555";
+    std::string backend = "tcp://*:5556";
+    Engine engine = Engine::Forwarder;
+    // Threads doing per-message work, messages are split between them by topic hash.
+    size_t shards = 1;
+    // libzmq I/O threads, which do the TCP work for all sockets.
+    int ioThreads = 1;
+    // CPUs the I/O threads are placed on (placement.threads.zmq-io).
+    std::vector<int> ioCpus;
+    // Makes XPUB report, rather than silently drop, messages a subscriber has
+    // no room for; the broker then drops and counts them, or holds them back
+    // for conflation. Always on with conflation.
+    bool xpubNodrop = false;
+    InterceptorSettings interceptor;
+    MetricsSettings metrics;
+    VerifySettings verify;
+    CaptureSettings capture;
+    LastValueSettings lastValue;
+    ConflateSettings conflate;
+    CompressSettings compress;
+    BridgeSettings bridge;
+
+    static ZmqSettings fromConfig(const Poco::Util::AbstractConfiguration &config)
+    {
+        ZmqSettings settings;
+        settings.frontend = config.getString("broker.frontend", settings.frontend);
+        settings.backend = config.getString("broker.backend", settings.backend);
+
+        const std::string engine = config.getString("broker.engine", "forwarder");
+        if (engine == "proxy")
+        {
+            settings.engine = Engine::Proxy;
         }
+        else if (engine != "forwarder")
+        {
+            throw Poco::InvalidArgumentException("broker.engine", engine);
+        }
+        settings.shards = std::max(1, config.getInt("broker.shards", static_cast<int>(settings.shards)));
+        // Placed I/O threads default to one per CPU they are placed on.
+        settings.ioCpus = ThreadPlacement::cpus("zmq-io");
+        const int ioThreads = settings.ioCpus.empty() ? settings.ioThreads : static_cast<int>(settings.ioCpus.size());
+        settings.ioThreads = std::max(1, config.getInt("broker.io_threads", ioThreads));
+        settings.xpubNodrop = config.getBool("broker.xpub_nodrop", settings.xpubNodrop);
+        settings.interceptor = InterceptorSettings::fromConfig(config);
+        settings.metrics = MetricsSettings::fromConfig(config);
+        settings.verify = VerifySettings::fromConfig(config);
+        settings.capture = CaptureSettings::fromConfig(config);
+        settings.lastValue = LastValueSettings::fromConfig(config);
+        settings.conflate = ConflateSettings::fromConfig(config);
+        settings.xpubNodrop = settings.xpubNodrop || settings.conflate.enabled();
+        settings.compress = CompressSettings::fromConfig(config);
+        settings.bridge = BridgeSettings::fromConfig(config);
+        if (settings.bridge.enabled && settings.compress.enabled)
+        {
+            // Both go through XPUB, so the bridge would get compressed frames.
+            throw Poco::InvalidArgumentException("bridge.enable", "cannot be combined with compress.enable");
+        }
+        return settings;
     }
 };
 
-class MessageInterceptor
+// Per-message work of the broker: everything that happens to a message between
+// XSUB and XPUB. With one shard it runs inline on the broker thread; with more,
+// each shard runs it on its own thread and exchanges messages with the broker
+// thread over an inproc PAIR socket.
+class ZmqShard : public Poco::Runnable
 {
   public:
-    void intercept(const zmq::message_t &topic, const zmq::message_t &message)
+    ZmqShard(const ZmqSettings &settings, size_t index)
+        : m_index(index), m_countTopics(settings.metrics.enabled), m_interceptor(settings.interceptor),
+          m_metrics(settings.metrics.maxTopics), m_verifier(settings.verify, m_metrics, settings.metrics.enabled),
+          m_capture(settings.capture, index),
+          m_compressor(settings.compress, settings.backend, m_metrics, settings.metrics.enabled), m_context(nullptr),
+          m_controlEndpoint{}, m_pair{}, m_control{}, m_thread{"shard-" + std::to_string(index)}
+    {
+    }
+
+    // Returns false if the message must not be forwarded.
+    bool process(Multipart &message)
+    {
+        bump(m_metrics.messages);
+        bump(m_metrics.bytes, message.bytes());
+        if (m_countTopics)
+        {
+            m_metrics.topics.record(topicHash(message.front()), message.front(), message.bytes());
+        }
+        if (!m_verifier.admit(message))
+        {
+            return false;
+        }
+
+        m_interceptor.intercept(message);
+        m_capture.capture(message);
+        m_compressor.compress(message);
+        return true;
+    }
+
+    // Inline mode: only the helpers run in the background. `run` names the
+    // capture files, the same for every shard.
+    void start(const std::string &run)
+    {
+        m_interceptor.start();
+        m_capture.start(run);
+    }
+
+    // Threaded mode: `endpoint` is the broker's end of this shard's PAIR.
+    void start(zmq::context_t &context, const std::string &endpoint, const std::string &run)
+    {
+        m_context = &context;
+        m_controlEndpoint = endpoint + "-control";
+
+        m_pair = zmq::socket_t(context, ZMQ_PAIR);
+        m_pair.set(zmq::sockopt::linger, 0);
+        m_pair.connect(endpoint);
+        m_control = zmq::socket_t(context, ZMQ_PAIR);
+        m_control.bind(m_controlEndpoint);
+
+        start(run);
+        m_thread.start(*this);
+    }
+
+    void stop()
+    {
+        if (m_thread.isRunning())
+        {
+            signalEndpoint(*m_context, m_controlEndpoint, "STOP");
+            m_thread.join();
+        }
+        m_interceptor.stop();
+        m_capture.stop();
+    }
+
+    // Blocks until there is work or a stop request; an idle shard costs no CPU.
+    void run() override
+    {
+        ThreadPlacement::apply();
+        Multipart message;
+        zmq::pollitem_t items[] = {{m_pair.handle(), 0, ZMQ_POLLIN, 0}, {m_control.handle(), 0, ZMQ_POLLIN, 0}};
+        bool running = true;
+        while (running)
+        {
+            zmq::poll(items, 2, std::chrono::milliseconds(-1));
+            running = !(items[1].revents & ZMQ_POLLIN);
+            for (size_t n = 0; running && n < ZmqProxy::kBatch && message.recv(m_pair, zmq::recv_flags::dontwait); ++n)
+            {
+                message.popStamp();
+                if (process(message))
+                {
+                    message.pushStamp();
+                    running = sendBack(message);
+                }
+                else
+                {
+                    bump(m_metrics.filtered);
+                }
+            }
+        }
+        m_pair.close();
+        m_control.close();
+    }
+
+    size_t index() const
+    {
+        return m_index;
+    }
+
+    const MessageInterceptor &interceptor() const
+    {
+        return m_interceptor;
+    }
+
+    const CaptureLog &capture() const
+    {
+        return m_capture;
+    }
+
+    const PayloadCompressor &compressor() const
     {
-        std::cout << "Intercepted: [" << topic.to_string() << "] " << message.to_string() << std::endl;
+        return m_compressor;
     }
+
+    const BrokerMetrics &metrics() const
+    {
+        return m_metrics;
+    }
+
+  private:
+    // Waits for room in the pipe back to the broker, but gives up on a stop
+    // request: the broker stops reading before it stops its shards.
+    bool sendBack(Multipart &message)
+    {
+        zmq::pollitem_t items[] = {{m_pair.handle(), 0, ZMQ_POLLOUT, 0}, {m_control.handle(), 0, ZMQ_POLLIN, 0}};
+        while (!message.send(m_pair, zmq::send_flags::dontwait))
+        {
+            zmq::poll(items, 2, std::chrono::milliseconds(-1));
+            if (items[1].revents & ZMQ_POLLIN)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t m_index;
+    bool m_countTopics;
+    MessageInterceptor m_interceptor;
+    BrokerMetrics m_metrics;
+    IngressVerifier m_verifier;
+    CaptureLog m_capture;
+    PayloadCompressor m_compressor;
+    zmq::context_t *m_context;
+    std::string m_controlEndpoint;
+    zmq::socket_t m_pair;
+    zmq::socket_t m_control;
+    Poco::Thread m_thread;
 };
 
 class ZmqTask : public Task
 {
   public:
-    ZmqTask() : Task{"ZmqTask"}, m_context(1), m_xsub(m_context, ZMQ_XSUB), m_xpub(m_context, ZMQ_XPUB), m_interceptor()
+    ZmqTask(const ZmqSettings &settings)
+        : Task{"ZmqTask"}, m_settings(settings), m_context(makeContext(settings)), m_xsub(m_context, ZMQ_XSUB),
+          m_xpub(m_context, ZMQ_XPUB), m_control(m_context, ZMQ_PAIR), m_stats{}, m_shards{}, m_shardPairs{},
+          m_shardSent{}, m_shardReturned{}, m_metrics(settings.metrics.maxTopics), m_lastValues(settings.lastValue),
+          m_conflator(settings.conflate, m_metrics), m_nextReport{0}
     {
-        m_xsub.bind("tcp://*:5555");
-        m_xsub.set(zmq::sockopt::rcvtimeo, 1000);
+        // With placed I/O threads, XSUB and XPUB traffic go through different ones.
+        if (!m_settings.ioCpus.empty() && m_settings.ioThreads > 1)
+        {
+            m_xsub.set(zmq::sockopt::affinity, uint64_t{1});
+            m_xpub.set(zmq::sockopt::affinity, uint64_t{2});
+        }
+        m_xsub.bind(m_settings.frontend);
+
+        if (m_settings.xpubNodrop)
+        {
+            m_xpub.set(zmq::sockopt::xpub_nodrop, 1);
+        }
+        m_lastValues.prepare(m_xpub);
+        m_xpub.bind(m_settings.backend);
+        if (m_settings.bridge.enabled)
+        {
+            m_xpub.bind(m_settings.bridge.endpoint);
+        }
+
+        m_control.bind(controlEndpoint());
 
-        m_xpub.bind("tcp://*:5556");
+        if (m_settings.metrics.enabled && !m_settings.metrics.endpoint.empty())
+        {
+            m_stats = zmq::socket_t(m_context, ZMQ_PUB);
+            m_stats.set(zmq::sockopt::linger, 0);
+            m_stats.bind(m_settings.metrics.endpoint);
+        }
+
+        for (size_t i = 0; i < m_settings.shards; ++i)
+        {
+            m_shards.emplace_back(new ZmqShard(m_settings, i));
+        }
+        if (m_shards.size() > 1)
+        {
+            for (size_t i = 0; i < m_shards.size(); ++i)
+            {
+                m_shardPairs.emplace_back(m_context, ZMQ_PAIR);
+                m_shardPairs.back().set(zmq::sockopt::linger, 0);
+                m_shardPairs.back().bind(shardEndpoint(i));
+            }
+            m_shardSent.resize(m_shards.size());
+            m_shardReturned.resize(m_shards.size());
+        }
     }
 
     void runTask() override
     {
+        ThreadPlacement::apply();
         Application &app = Application::instance();
         app.logger().information("zmq task uptime: " + DateTimeFormatter::format(app.uptime()));
 
-        while (!isCancelled())
+        if (m_settings.engine == ZmqSettings::Engine::Proxy)
         {
-            zmq::message_t topic_msg, message_msg;
-            m_xsub.recv(topic_msg, zmq::recv_flags::none);
-            m_xsub.recv(message_msg, zmq::recv_flags::none);
+            if (m_settings.verify.policy != VerifySettings::Policy::Off)
+            {
+                app.logger().warning("verify.policy has no effect with broker.engine = proxy");
+            }
+            if (m_settings.capture.enabled)
+            {
+                app.logger().warning("capture.enable has no effect with broker.engine = proxy");
+            }
+            if (m_settings.lastValue.enabled)
+            {
+                app.logger().warning("lvc.enable has no effect with broker.engine = proxy");
+            }
+            if (m_settings.conflate.enabled())
+            {
+                app.logger().warning("conflate.topics has no effect with broker.engine = proxy");
+            }
+            if (m_settings.compress.enabled)
+            {
+                app.logger().warning("compress.enable has no effect with broker.engine = proxy");
+            }
+            runProxy();
+            return;
+        }
 
-            m_interceptor.intercept(topic_msg, message_msg);
+        if (m_settings.compress.enabled && !PayloadCompressor::available())
+        {
+            app.logger().warning("compress.enable has no effect, pocoex was built without LZ4");
+        }
+        else if (m_settings.compress.enabled && !PayloadCompressor::appliesTo(m_settings.backend))
+        {
+            app.logger().warning("compress.enable has no effect, broker.backend " + m_settings.backend +
+                                 " is not a tcp endpoint");
+        }
+        if (m_settings.lastValue.enabled && !LastValueCache::available())
+        {
+            app.logger().warning("lvc.enable has no effect, libzmq lacks the draft ZMQ_XPUB_MANUAL_LAST_VALUE option");
+        }
 
-            m_xpub.send(topic_msg, zmq::send_flags::sndmore);
-            m_xpub.send(message_msg, zmq::send_flags::none);
+        const std::string run = m_settings.capture.enabled ? CaptureLog::newRun(m_settings.capture) : "";
+        if (m_shards.size() == 1)
+        {
+            m_shards[0]->start(run);
+            runInline();
         }
+        else
+        {
+            for (auto &shard : m_shards)
+            {
+                shard->start(m_context, shardEndpoint(shard->index()), run);
+            }
+            runSharded();
+        }
+
+        for (auto &shard : m_shards)
+        {
+            shard->stop();
+            app.logger().information("shard " + std::to_string(shard->index()) + " interceptor dropped " +
+                                     std::to_string(shard->interceptor().dropped()) + " samples, rate-limited " +
+                                     std::to_string(shard->interceptor().rateLimited()));
+            if (m_settings.capture.enabled)
+            {
+                app.logger().information("shard " + std::to_string(shard->index()) + " captured " +
+                                         std::to_string(shard->capture().captured()) + " messages in " +
+                                         std::to_string(shard->capture().segments()) + " segments, dropped " +
+                                         std::to_string(shard->capture().dropped()));
+            }
+            if (shard->compressor().enabled())
+            {
+                const BrokerMetrics &metrics = shard->metrics();
+                app.logger().information("shard " + std::to_string(shard->index()) + " compressed " +
+                                         std::to_string(metrics.compressed.load()) + " frames, " +
+                                         std::to_string(metrics.compressIn.load()) + " to " +
+                                         std::to_string(metrics.compressOut.load()) + " bytes; sent " +
+                                         std::to_string(metrics.compressSkipped.load()) +
+                                         " uncompressed that compressed poorly");
+            }
+        }
+        if (m_lastValues.enabled())
+        {
+            app.logger().information("last-value cache holds " + std::to_string(m_lastValues.topics()) + " topics, " +
+                                     std::to_string(m_lastValues.bytes()) + " bytes; replayed " +
+                                     std::to_string(m_lastValues.replayed()) + " messages, refused " +
+                                     std::to_string(m_lastValues.refused()) + ", evicted " +
+                                     std::to_string(m_lastValues.evicted()) + " topics");
+        }
+    }
+
+    // In-process subscribers connect to XPUB's inproc endpoint in this context.
+    zmq::context_t &context()
+    {
+        return m_context;
+    }
+
+    // Wakes the broker thread straight away, wherever it is blocked.
+    void cancel() override
+    {
+        Task::cancel();
+        signalEndpoint(m_context, controlEndpoint(), "TERMINATE");
     }
 
   private:
+    // The I/O threads start with the first socket, so their placement has
+    // to be on the context before any socket exists.
+    static zmq::context_t makeContext(const ZmqSettings &settings)
+    {
+        zmq::context_t context(settings.ioThreads);
+        for (int cpu : settings.ioCpus)
+        {
+            context.set(zmq::ctxopt::thread_affinity_cpu_add, cpu);
+        }
+        return context;
+    }
+
+    std::string controlEndpoint() const
+    {
+        return "inproc://zmqtask-control-" + std::to_string(reinterpret_cast<uintptr_t>(this));
+    }
+
+    static std::string shardEndpoint(size_t index)
+    {
+        return "inproc://zmqtask-shard-" + std::to_string(index);
+    }
+
+    zmq::send_flags egressFlags() const
+    {
+        return m_settings.xpubNodrop ? zmq::send_flags::dontwait : zmq::send_flags::none;
+    }
+
+    // Sends one message to XPUB. Once XPUB has taken it, it is cached and
+    // counted as forwarded, with its latency if it carries the broker's
+    // stamp, so a held-back update is counted when it leaves, not when held.
+    bool deliver(Multipart &message)
+    {
+        const size_t bytes = message.bytes();
+        const uint64_t stamp = message.stamp();
+        m_lastValues.stage(message);
+        if (!message.send(m_xpub, egressFlags()))
+        {
+            return false;
+        }
+        m_lastValues.commit();
+        if (stamp != 0)
+        {
+            m_metrics.latency.record(monotonicNanos() - stamp);
+        }
+        bump(m_metrics.messages);
+        bump(m_metrics.bytes, bytes);
+        return true;
+    }
+
+    // Returns false for a message that was dropped; with conflation a
+    // refused update may instead be held back and delivered later, counted
+    // only as deferred or conflated until then.
+    bool forward(Multipart &message)
+    {
+        if (m_settings.conflate.enabled())
+        {
+            return m_conflator.send(message, [this](Multipart &update) { return deliver(update); }) !=
+                   Conflator::Outcome::Dropped;
+        }
+        return deliver(message);
+    }
+
+    void flushHeld()
+    {
+        m_conflator.flush([this](Multipart &update) { return deliver(update); });
+    }
+
+    // How long the broker may block before the next statistics report or
+    // retry of held-back updates is due.
+    std::chrono::milliseconds pollTimeout() const
+    {
+        std::chrono::milliseconds timeout(-1);
+        if (m_settings.metrics.enabled)
+        {
+            const uint64_t now = monotonicNanos();
+            timeout = std::chrono::milliseconds(m_nextReport > now ? (m_nextReport - now) / 1000000 + 1 : 0);
+        }
+        if (m_conflator.pending() && (timeout.count() < 0 || timeout > m_conflator.retry()))
+        {
+            timeout = m_conflator.retry();
+        }
+        return timeout;
+    }
+
+    void reportIfDue()
+    {
+        if (!m_settings.metrics.enabled)
+        {
+            return;
+        }
+        const uint64_t now = monotonicNanos();
+        if (now < m_nextReport)
+        {
+            return;
+        }
+        m_nextReport = now + static_cast<uint64_t>(m_settings.metrics.interval) * 1000000;
+
+        std::vector<MetricsReport::Shard> shards;
+        for (size_t i = 0; i < m_shards.size(); ++i)
+        {
+            const BrokerMetrics &metrics = m_shards[i]->metrics();
+            uint64_t depth = 0;
+            if (!m_shardSent.empty())
+            {
+                depth = m_shardSent[i] - m_shardReturned[i] - metrics.filtered.load(std::memory_order_relaxed);
+            }
+            shards.push_back({&metrics, depth});
+        }
+        const std::string report = MetricsReport::format(m_metrics, shards, m_settings.metrics.topTopics);
+
+        if (m_stats)
+        {
+            m_stats.send(zmq::buffer(report), zmq::send_flags::dontwait);
+        }
+        if (!m_settings.metrics.sysTopic.empty())
+        {
+            // Never wait for a slow subscriber here, statistics can be skipped.
+            if (m_xpub.send(zmq::buffer(m_settings.metrics.sysTopic),
+                            zmq::send_flags::sndmore | zmq::send_flags::dontwait))
+            {
+                m_xpub.send(zmq::buffer(report), zmq::send_flags::dontwait);
+            }
+        }
+    }
+
+    void runInline()
+    {
+        ZmqShard &shard = *m_shards[0];
+        ZmqProxy proxy(m_xsub, m_xpub, &m_control, egressFlags());
+        const bool timed = m_settings.metrics.enabled;
+        auto process = [this, &shard, timed](Multipart &message) {
+            const uint64_t start = timed ? monotonicNanos() : 0;
+            const bool forward = shard.process(message);
+            if (timed)
+            {
+                m_metrics.latency.record(monotonicNanos() - start);
+            }
+            return forward;
+        };
+        auto subscribed = [this](Multipart &subscription) {
+            m_lastValues.subscription(m_xpub, subscription.front());
+            return true;
+        };
+        // With a sender, deliver() counts what XPUB actually took.
+        const bool delivering = m_settings.conflate.enabled() || m_lastValues.enabled();
+        if (delivering)
+        {
+            proxy.setSender([this](Multipart &message) { return forward(message); });
+        }
+
+        while (!proxy.interrupted())
+        {
+            proxy.poll(process, subscribed, pollTimeout());
+            flushHeld();
+            if (!delivering)
+            {
+                m_metrics.messages.store(proxy.downstream().messages(), std::memory_order_relaxed);
+                m_metrics.bytes.store(proxy.downstream().bytes(), std::memory_order_relaxed);
+            }
+            m_metrics.filtered.store(proxy.downstream().filtered(), std::memory_order_relaxed);
+            m_metrics.hwmDrops.store(proxy.downstream().refused(), std::memory_order_relaxed);
+            reportIfDue();
+        }
+
+        Application::instance().logger().information(
+            "zmq task forwarded " + std::to_string(m_metrics.messages.load()) + " messages, " +
+            std::to_string(m_metrics.bytes.load()) + " bytes, " + std::to_string(proxy.upstream().messages()) +
+            " subscription changes");
+    }
+
+    // The broker thread owns XSUB and XPUB, as ZMQ sockets are single-threaded.
+    // It hands each published message to the shard chosen by its topic hash
+    // and sends whatever the shards hand back to XPUB. A topic always goes
+    // through the same shard and every hop is FIFO, so per-topic order holds.
+    // Hand-off to a shard never blocks: if its pipe is full the message waits
+    // here and XSUB is not read until the shard can take it, otherwise the
+    // broker and a shard could block on each other's full pipes.
+    void runSharded()
+    {
+        const size_t shards = m_shardPairs.size();
+        std::vector<zmq::pollitem_t> items(3 + shards);
+        Multipart ingress, egress, subscription;
+        bool pending = false;
+        size_t pendingShard = 0;
+        uint64_t published = 0, subscriptions = 0;
+
+        for (;;)
+        {
+            items[0] = {m_xsub.handle(), 0, static_cast<short>(pending ? 0 : ZMQ_POLLIN), 0};
+            items[1] = {m_xpub.handle(), 0, ZMQ_POLLIN, 0};
+            items[2] = {m_control.handle(), 0, ZMQ_POLLIN, 0};
+            for (size_t i = 0; i < shards; ++i)
+            {
+                const short out = pending && pendingShard == i ? ZMQ_POLLOUT : 0;
+                items[3 + i] = {m_shardPairs[i].handle(), 0, static_cast<short>(ZMQ_POLLIN | out), 0};
+            }
+            zmq::poll(items, pollTimeout());
+            if (items[2].revents & ZMQ_POLLIN)
+            {
+                break;
+            }
+            reportIfDue();
+            flushHeld();
+
+            for (size_t i = 0; i < shards; ++i)
+            {
+                for (size_t n = 0; n < ZmqProxy::kBatch && egress.recv(m_shardPairs[i], zmq::recv_flags::dontwait);
+                     ++n)
+                {
+                    ++m_shardReturned[i];
+                    egress.popStamp();
+                    if (!forward(egress))
+                    {
+                        bump(m_metrics.hwmDrops);
+                    }
+                }
+            }
+
+            if (items[1].revents & ZMQ_POLLIN)
+            {
+                for (size_t n = 0; n < ZmqProxy::kBatch && subscription.recv(m_xpub, zmq::recv_flags::dontwait); ++n)
+                {
+                    m_lastValues.subscription(m_xpub, subscription.front());
+                    subscription.send(m_xsub);
+                    ++subscriptions;
+                }
+            }
+
+            if (pending && ingress.send(m_shardPairs[pendingShard], zmq::send_flags::dontwait))
+            {
+                ++m_shardSent[pendingShard];
+                pending = false;
+            }
+
+            for (size_t n = 0; !pending && n < ZmqProxy::kBatch && ingress.recv(m_xsub, zmq::recv_flags::dontwait);
+                 ++n)
+            {
+                ++published;
+                ingress.setStamp(m_settings.metrics.enabled ? monotonicNanos() : 0);
+                const size_t shard = topicHash(ingress.front()) % shards;
+                ingress.pushStamp();
+                if (ingress.send(m_shardPairs[shard], zmq::send_flags::dontwait))
+                {
+                    ++m_shardSent[shard];
+                }
+                else
+                {
+                    bump(m_metrics.shardStalls);
+                    pending = true;
+                    pendingShard = shard;
+                }
+            }
+        }
+
+        Application::instance().logger().information(
+            "zmq task received " + std::to_string(published) + " messages over " + std::to_string(shards) +
+            " shards, forwarded " + std::to_string(m_metrics.messages.load()) + ", " +
+            std::to_string(subscriptions) + " subscription changes");
+    }
+
+    // zmq_proxy_steerable returns when the control socket reads TERMINATE.
+    void runProxy()
+    {
+        zmq::proxy_steerable(m_xsub, m_xpub, zmq::socket_ref(), m_control);
+    }
+
+    ZmqSettings m_settings;
     zmq::context_t m_context;
     zmq::socket_t m_xsub;
     zmq::socket_t m_xpub;
-    MessageInterceptor m_interceptor;
+    zmq::socket_t m_control;
+    zmq::socket_t m_stats;
+    std::vector<std::unique_ptr<ZmqShard>> m_shards;
+    std::vector<zmq::socket_t> m_shardPairs;
+    // Broker-thread counts of messages handed to and received back from each shard.
+    std::vector<uint64_t> m_shardSent;
+    std::vector<uint64_t> m_shardReturned;
+    BrokerMetrics m_metrics;
+    LastValueCache m_lastValues;
+    Conflator m_conflator;
+    uint64_t m_nextReport;
 };
 
 class MySubsystem : public Subsystem
 {
   public:
-    MySubsystem(NotificationQueue *queue) : _parameterValue(""), m_zmqTask{}, m_thread{}
+    MySubsystem(SampleConsumers *consumers) : _parameterValue(""), m_zmqTask{}, m_thread{"broker"}
     {
     }
 
@@ -191,13 +890,22 @@ class MySubsystem : public Subsystem
     void initialize(Application &app) override
     {
         std::cout << "MySubsystem initialized with parameter: " << _parameterValue << std::endl;
-        m_thread.start(m_zmqTask);
+        m_zmqTask = new ZmqTask(ZmqSettings::fromConfig(app.config()));
+        m_thread.start(*m_zmqTask);
+    }
+
+    zmq::context_t &context()
+    {
+        return m_zmqTask->context();
     }
 
     void uninitialize() override
     {
-        m_zmqTask.cancel();
-        m_thread.join();
+        if (m_zmqTask)
+        {
+            m_zmqTask->cancel();
+            m_thread.join();
+        }
         std::cout << "MySubsystem uninitialized" << std::endl;
     }
 
@@ -219,16 +927,23 @@ class MySubsystem : public Subsystem
 
   private:
     std::string _parameterValue;
-    ZmqTask m_zmqTask;
+    Poco::AutoPtr<ZmqTask> m_zmqTask;
     Thread m_thread;
 };
 
 class SampleServer : public ServerApplication
 {
   public:
-    SampleServer() : mHelpRequested{false}, m_tm{}, m_queue{}
+    SampleServer()
+        : mHelpRequested{false}, m_tm{}, m_log{new AsyncLogger}, m_pool{kPoolCapacity},
+          m_consumers{[log = m_log](std::span<SamplePool::Ptr> notifications) { consumeSamples(*log, notifications); }}
     {
-        addSubsystem(new MySubsystem(&m_queue));
+        // Placement comes first so it is configured before any subsystem
+        // starts a thread; the logger next, so it is uninitialized after the
+        // others and their logs are still written while they shut down.
+        addSubsystem(new PlacementSubsystem);
+        addSubsystem(m_log);
+        addSubsystem(new MySubsystem(&m_consumers));
     }
 
     ~SampleServer()
@@ -298,7 +1013,8 @@ class SampleServer : public ServerApplication
 
         // std::cout << "============>:" << builder.GetSize() << ", name:" << monster.name << std::endl;
 
-        flatbuffers::FlatBufferBuilder builder;
+        FlatBufferBuilderPool::Lease lease = FlatBufferBuilderPool::local().acquire();
+        flatbuffers::FlatBufferBuilder &builder = lease.builder();
 
         static const int32_t weapon_ids[] = {1, 2, 3, 4};
 
@@ -381,8 +1097,13 @@ class SampleServer : public ServerApplication
 #endif
 
             // 任务管理器中添加一个任务
-            m_tm.start(new ProducerTask(m_queue));
-            m_tm.start(new ConsumerTask(m_queue));
+            m_consumers.start(ConsumerPoolSettings::fromConfig(config()));
+            // Broker traffic into the consumers without a copy; started after
+            // and stopped before them.
+            const BridgeSettings bridgeSettings = BridgeSettings::fromConfig(config());
+            InprocBridge<SampleNotification> bridge(bridgeSettings, m_pool, m_consumers);
+            bridge.start(getSubsystem<MySubsystem>().context());
+            m_tm.start(new ProducerTask(m_pool, m_consumers));
 
             // 等待终止请求 Ctrl+C
             waitForTerminationRequest();
@@ -390,15 +1111,40 @@ class SampleServer : public ServerApplication
             // 取消所有任务
             m_tm.cancelAll();
             m_tm.joinAll();
+
+            bridge.stop();
+            if (bridgeSettings.enabled)
+            {
+                logger().information("Bridge: " + std::to_string(bridge.received()) + " messages, " +
+                                     std::to_string(bridge.bytes()) + " bytes");
+            }
+            m_consumers.stop();
+            const std::vector<SampleConsumers::WorkerStats> workers = m_consumers.stats();
+            for (size_t i = 0; i < workers.size(); ++i)
+            {
+                logger().information("Consumer " + std::to_string(i) + ": " + std::to_string(workers[i].handled) +
+                                     " handled, " + std::to_string(workers[i].stolen) + " stolen");
+            }
+
+            const SamplePool::Stats pool = m_pool.stats();
+            logger().information("Notification pool: " + std::to_string(pool.hits) + " hits, " +
+                                 std::to_string(pool.misses) + " misses, " + std::to_string(pool.discarded) +
+                                 " discarded, " + std::to_string(pool.available) + " available");
         }
 
         return Application::EXIT_OK;
     }
 
   private:
+    static constexpr size_t kPoolCapacity = 1024;
+
     bool mHelpRequested;
     TaskManager m_tm;
-    NotificationQueue m_queue;
+    // Owned by the application's subsystem list, which outlives the consumers.
+    AsyncLogger *m_log;
+    // Declared before the consumers so it outlives any notification still queued.
+    SamplePool m_pool;
+    SampleConsumers m_consumers;
 };
 
 POCO_SERVER_MAIN(SampleServer)
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "monster_generated.h"
+
+// Per-message dispatch resolved at compile time. The set of topics or union
+// types is a template argument, so a message reaches its handler through a
+// constant table of function pointers: no virtual call, no RTTI, no
+// allocation. Nothing here depends on ZeroMQ or Poco, so the broker thread
+// and the consumer workers can share handler code.
+
+// A string literal usable as a template argument.
+template <size_t N> struct FixedString
+{
+    char chars[N]{};
+
+    constexpr FixedString(const char (&text)[N])
+    {
+        std::copy_n(text, N, chars);
+    }
+
+    constexpr std::string_view view() const
+    {
+        return {chars, N - 1};
+    }
+};
+
+// Lets a set of lambdas act as one handler with an overload per type.
+template <typename... Handlers> struct Overloaded : Handlers...
+{
+    using Handlers::operator()...;
+};
+
+// Calls the handler overload for the table behind a union value, through a
+// table indexed by the type tag and built from the union's generated traits
+// (AnyTraits for MyGame::Any). Types the handler has no overload for, NONE
+// and tags from a newer schema reach nothing and return false.
+template <template <typename> class Traits, typename... Types> struct UnionDispatcher
+{
+    static constexpr size_t kTags = std::max({static_cast<size_t>(Traits<Types>::enum_value)...}) + 1;
+
+    template <typename Handler> static bool dispatch(uint8_t tag, const void *value, Handler &&handler)
+    {
+        using Entry = bool (*)(const void *, Handler &);
+        static constexpr std::array<Entry, kTags> table = [] {
+            std::array<Entry, kTags> entries{};
+            entries.fill(&ignore<Handler>);
+            ((entries[Traits<Types>::enum_value] = &invoke<Types, Handler>), ...);
+            return entries;
+        }();
+        return tag < kTags && value && table[tag](value, handler);
+    }
+
+  private:
+    template <typename Handler> static bool ignore(const void *, Handler &)
+    {
+        return false;
+    }
+
+    template <typename T, typename Handler> static bool invoke(const void *value, Handler &handler)
+    {
+        if constexpr (std::is_invocable_v<Handler &, const T &>)
+        {
+            handler(*static_cast<const T *>(value));
+            return true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+};
+
+using AnyDispatcher = UnionDispatcher<MyGame::AnyTraits, MyGame::Monster, MyGame::Weapon, MyGame::Pickup>;
+
+// Dispatches a Monster's `test` union:
+//
+//   dispatchTest(monster, Overloaded{
+//       [](const MyGame::Weapon &weapon) { ... },
+//       [](const MyGame::Pickup &pickup) { ... }});
+template <typename Handler> bool dispatchTest(const MyGame::Monster &monster, Handler &&handler)
+{
+    return AnyDispatcher::dispatch(monster.test_type(), monster.test(), std::forward<Handler>(handler));
+}
+
+// An ordered set of topic prefixes. route() tries them in order, which
+// unrolls into one fixed-length compare per prefix, so more specific
+// prefixes go first.
+template <FixedString... Prefixes> struct TopicList
+{
+    static constexpr size_t kNone = sizeof...(Prefixes);
+
+    // Index of the first prefix `topic` starts with, kNone if there is none.
+    static constexpr size_t route(std::string_view topic)
+    {
+        size_t index = 0;
+        const bool found = ((topic.starts_with(Prefixes.view()) || (++index, false)) || ...);
+        return found ? index : kNone;
+    }
+};
+
+// Hands each message to the handler of the topic prefix it matches, one
+// handler per prefix, stored by value:
+//
+//   auto router = makeTopicRouter<"monster/", "weapon/">(
+//       [](const zmq::message_t &payload) { ... },
+//       [](const zmq::message_t &payload) { ... });
+//   router.dispatch(topic.to_string_view(), payload);
+//
+// A caller that sees the same topics again can keep route() per topic and
+// skip the prefix compares with dispatchRoute().
+template <typename Topics, typename... Handlers> class TopicRouter
+{
+    static_assert(Topics::kNone == sizeof...(Handlers), "one handler per topic prefix");
+
+  public:
+    static constexpr size_t kNone = Topics::kNone;
+
+    explicit TopicRouter(Handlers... handlers) : m_handlers(std::move(handlers)...)
+    {
+    }
+
+    static constexpr size_t route(std::string_view topic)
+    {
+        return Topics::route(topic);
+    }
+
+    // Returns false, calling nothing, if no prefix matches.
+    template <typename... Args> bool dispatch(std::string_view topic, Args &&...args)
+    {
+        return dispatchRoute(route(topic), std::forward<Args>(args)...);
+    }
+
+    template <typename... Args> bool dispatchRoute(size_t route, Args &&...args)
+    {
+        using Entry = void (*)(TopicRouter &, Args &...);
+        static constexpr std::array<Entry, sizeof...(Handlers)> table =
+            []<size_t... I>(std::index_sequence<I...>) {
+                return std::array<Entry, sizeof...(Handlers)>{&invoke<I, Args...>...};
+            }(std::index_sequence_for<Handlers...>{});
+        if (route >= kNone)
+        {
+            return false;
+        }
+        table[route](*this, args...);
+        return true;
+    }
+
+  private:
+    template <size_t I, typename... Args> static void invoke(TopicRouter &router, Args &...args)
+    {
+        std::get<I>(router.m_handlers)(args...);
+    }
+
+    std::tuple<Handlers...> m_handlers;
+};
+
+template <FixedString... Prefixes, typename... Handlers>
+TopicRouter<TopicList<Prefixes...>, Handlers...> makeTopicRouter(Handlers... handlers)
+{
+    return TopicRouter<TopicList<Prefixes...>, Handlers...>(std::move(handlers)...);
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+#include "Poco/Event.h"
+#include "Poco/Runnable.h"
+#include "Poco/Thread.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Util/AbstractConfiguration.h"
+
+#include "spsc_ring.h"
+#include "thread_placement.h"
+#include "zmq_forwarder.h"
+
+struct InterceptorSettings
+{
+    bool enabled = true;
+    // Keep one message in `sampleEvery`.
+    uint32_t sampleEvery = 1;
+    // Per-topic cap on sampled messages per second, 0 for no cap.
+    uint32_t topicRate = 0;
+    // Ring slots between the broker and the printing thread.
+    size_t capacity = 8192;
+
+    static InterceptorSettings fromConfig(const Poco::Util::AbstractConfiguration &config)
+    {
+        InterceptorSettings settings;
+        settings.enabled = config.getBool("interceptor.enable", settings.enabled);
+        settings.sampleEvery = std::max(1, config.getInt("interceptor.sample_every", settings.sampleEvery));
+        settings.topicRate = std::max(0, config.getInt("interceptor.topic_rate", settings.topicRate));
+        settings.capacity = std::max(2, config.getInt("interceptor.capacity", static_cast<int>(settings.capacity)));
+        return settings;
+    }
+};
+
+// Observes forwarded messages without slowing the forwarding thread down.
+// intercept() samples, copies a short prefix of the topic and first payload
+// into a preallocated ring slot and returns; a separate thread drains the ring
+// and prints. When the ring is full the sample is dropped and counted.
+class MessageInterceptor : public Poco::Runnable
+{
+  public:
+    static constexpr size_t kTopicBytes = 64;
+    static constexpr size_t kPreviewBytes = 64;
+
+    explicit MessageInterceptor(const InterceptorSettings &settings)
+        : m_settings(settings), m_ring(settings.capacity), m_buckets(kBuckets), m_seen{0}, m_thread{"interceptor"}
+    {
+    }
+
+    ~MessageInterceptor()
+    {
+        stop();
+    }
+
+    void start()
+    {
+        if (m_settings.enabled && !m_thread.isRunning())
+        {
+            m_stopped = false;
+            m_thread.start(*this);
+        }
+    }
+
+    void stop()
+    {
+        if (m_thread.isRunning())
+        {
+            m_stopped = true;
+            m_wakeup.set();
+            m_thread.join();
+        }
+    }
+
+    // Called on the forwarding thread for every message.
+    void intercept(const Multipart &message)
+    {
+        if (!m_settings.enabled || ++m_seen % m_settings.sampleEvery != 0)
+        {
+            return;
+        }
+
+        const zmq::message_t &topic = message.front();
+        const int64_t now = Poco::Timestamp().epochMicroseconds();
+        if (m_settings.topicRate != 0 && !admit(topic.to_string_view(), now))
+        {
+            m_limited.store(m_limited.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+
+        const bool pushed = m_ring.tryPush([&](Sample &sample) {
+            sample.time = now;
+            sample.frames = static_cast<uint32_t>(message.size());
+            sample.bytes = message.bytes();
+            sample.topicSize = copyPrefix(sample.topic, kTopicBytes, topic);
+            sample.previewSize = message.size() > 1 ? copyPrefix(sample.preview, kPreviewBytes, message[1]) : 0;
+        });
+
+        if (!pushed)
+        {
+            m_dropped.store(m_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+
+        // Only wake the printer if it went to sleep on an empty ring.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleeping.load(std::memory_order_relaxed))
+        {
+            m_sleeping.store(false, std::memory_order_relaxed);
+            m_wakeup.set();
+        }
+    }
+
+    uint64_t dropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+    uint64_t rateLimited() const
+    {
+        return m_limited.load(std::memory_order_relaxed);
+    }
+
+    void run() override
+    {
+        ThreadPlacement::apply();
+        while (!m_stopped.load(std::memory_order_relaxed))
+        {
+            if (printAvailable() == 0)
+            {
+                m_sleeping.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (m_ring.empty() && !m_stopped.load(std::memory_order_relaxed))
+                {
+                    m_wakeup.wait();
+                }
+                m_sleeping.store(false, std::memory_order_relaxed);
+            }
+        }
+        printAvailable();
+    }
+
+  private:
+    static constexpr size_t kBuckets = 4096;
+
+    struct Sample
+    {
+        int64_t time;
+        uint32_t frames;
+        uint64_t bytes;
+        uint32_t topicSize;
+        uint32_t previewSize;
+        char topic[kTopicBytes];
+        char preview[kPreviewBytes];
+    };
+
+    // Token bucket per topic hash. Topics that collide share a bucket, which
+    // only makes the limit stricter for them.
+    struct Bucket
+    {
+        int64_t refilled = 0;
+        double tokens = 0;
+    };
+
+    static uint32_t copyPrefix(char *to, size_t capacity, const zmq::message_t &from)
+    {
+        const size_t size = std::min(capacity, from.size());
+        std::memcpy(to, from.data(), size);
+        return static_cast<uint32_t>(size);
+    }
+
+    bool admit(std::string_view topic, int64_t now)
+    {
+        Bucket &bucket = m_buckets[std::hash<std::string_view>{}(topic) & (kBuckets - 1)];
+        const double rate = m_settings.topicRate;
+        bucket.tokens = std::min(rate, bucket.tokens + (now - bucket.refilled) * rate / 1e6);
+        bucket.refilled = now;
+        if (bucket.tokens < 1.0)
+        {
+            return false;
+        }
+        bucket.tokens -= 1.0;
+        return true;
+    }
+
+    size_t printAvailable()
+    {
+        const size_t printed = m_ring.drain([](const Sample &sample) {
+            std::cout << "Intercepted: [" << std::string_view(sample.topic, sample.topicSize) << "] ";
+            for (uint32_t i = 0; i < sample.previewSize; ++i)
+            {
+                const char c = sample.preview[i];
+                std::cout << (c >= 0x20 && c < 0x7f ? c : '.');
+            }
+            std::cout << " (" << sample.frames << " frames, " << sample.bytes << " bytes)\n";
+        });
+        if (printed != 0)
+        {
+            std::cout.flush();
+        }
+        return printed;
+    }
+
+    InterceptorSettings m_settings;
+    SpscRing<Sample> m_ring;
+    std::vector<Bucket> m_buckets;
+    uint64_t m_seen;
+    std::atomic<uint64_t> m_dropped{0};
+    std::atomic<uint64_t> m_limited{0};
+    std::atomic<bool> m_sleeping{false};
+    std::atomic<bool> m_stopped{false};
+    Poco::Event m_wakeup;
+    Poco::Thread m_thread;
+};
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include <flatbuffers/flatbuffers.h>
+#include <zmq.hpp>
+
+#include "broker_metrics.h"
+#include "flatbuffer_frame.h"
+#include "monster_batch_generated.h"
+
+struct BatchSettings
+{
+    // A batch is sent as soon as it holds this many Monsters...
+    size_t maxMonsters = 64;
+    // ...or its buffer has grown to this many bytes...
+    size_t maxBytes = 16384;
+    // ...or its first Monster has waited this long, see flushIfDue().
+    uint64_t maxDelayNanos = 1000000;
+};
+
+// Whether a frame holds a MonsterBatch rather than a single Monster, going by
+// the batch schema's file identifier.
+inline bool isMonsterBatch(const zmq::message_t &frame)
+{
+    return frame.size() >= sizeof(flatbuffers::uoffset_t) + flatbuffers::kFileIdentifierLength &&
+           MyGame::MonsterBatchBufferHasIdentifier(frame.data());
+}
+
+// Publishes Monsters in MonsterBatch frames, so a stream of small entities
+// pays the ZMQ frame, topic frame and root overhead once per batch instead of
+// once per Monster. Monsters are built directly in the batch's builder, which
+// keeps vtable deduplication on: all Monsters with the same set of fields
+// share one vtable. A full batch is released zero-copy and handed to the sink.
+//
+// Nothing runs in the background; a publisher whose Monsters may trickle in
+// calls flushIfDue() from its loop, and flush() before it stops.
+//
+//   MonsterBatcher batcher(settings, [&](zmq::message_t &&batch, size_t) {
+//       socket.send(zmq::buffer(topic), zmq::send_flags::sndmore);
+//       socket.send(batch, zmq::send_flags::none);
+//   });
+//   auto name = batcher.builder().CreateString("Orc");
+//   MyGame::MonsterBuilder monster(batcher.builder());
+//   monster.add_name(name);
+//   batcher.add(monster.Finish());
+class MonsterBatcher
+{
+  public:
+    using Sink = std::function<void(zmq::message_t &&batch, size_t monsters)>;
+
+    struct Stats
+    {
+        uint64_t batches;
+        uint64_t monsters;
+    };
+
+    MonsterBatcher(const BatchSettings &settings, Sink sink)
+        : m_settings(settings), m_sink(std::move(sink)), m_builder(settings.maxBytes, &RecyclingAllocator::shared())
+    {
+        m_builder.DedupVtables(true);
+        m_monsters.reserve(settings.maxMonsters);
+    }
+
+    MonsterBatcher(const MonsterBatcher &) = delete;
+    MonsterBatcher &operator=(const MonsterBatcher &) = delete;
+
+    // Where the next Monster is to be built. Only Monsters and what they
+    // reference may be built here, and each must be passed to add().
+    flatbuffers::FlatBufferBuilder &builder()
+    {
+        return m_builder;
+    }
+
+    // Adds a Monster finished in builder(). Returns whether this sent the batch.
+    bool add(flatbuffers::Offset<MyGame::Monster> monster)
+    {
+        if (m_monsters.empty())
+        {
+            m_first = monotonicNanos();
+        }
+        m_monsters.push_back(monster);
+        if (m_monsters.size() >= m_settings.maxMonsters || m_builder.GetSize() >= m_settings.maxBytes)
+        {
+            return flush();
+        }
+        return false;
+    }
+
+    // Sends the batch if its oldest Monster has waited out maxDelayNanos.
+    bool flushIfDue()
+    {
+        if (m_monsters.empty() || monotonicNanos() - m_first < m_settings.maxDelayNanos)
+        {
+            return false;
+        }
+        return flush();
+    }
+
+    // Sends whatever is batched. Returns false if there was nothing.
+    bool flush()
+    {
+        if (m_monsters.empty())
+        {
+            return false;
+        }
+        const auto monsters = m_builder.CreateVector(m_monsters);
+        MyGame::FinishMonsterBatchBuffer(m_builder, MyGame::CreateMonsterBatch(m_builder, monsters));
+
+        const size_t count = m_monsters.size();
+        m_monsters.clear();
+        ++m_stats.batches;
+        m_stats.monsters += count;
+        m_sink(releaseFrame(m_builder), count);
+        return true;
+    }
+
+    size_t pending() const
+    {
+        return m_monsters.size();
+    }
+
+    Stats stats() const
+    {
+        return m_stats;
+    }
+
+  private:
+    BatchSettings m_settings;
+    Sink m_sink;
+    flatbuffers::FlatBufferBuilder m_builder;
+    std::vector<flatbuffers::Offset<MyGame::Monster>> m_monsters;
+    uint64_t m_first = 0;
+    Stats m_stats{0, 0};
+};
+
+// Walks the Monsters of a batch received in a ZMQ frame, in place unless the
+// frame is misaligned. Like the FlatBufferView it is built on, it verifies the
+// whole batch up front unless told not to, and can be neither copied nor
+// moved.
+//
+//   MonsterBatchView batch(frame);
+//   for (const MyGame::Monster *monster : batch)
+//       use(monster->name());
+class MonsterBatchView
+{
+    using Monsters = flatbuffers::Vector<flatbuffers::Offset<MyGame::Monster>>;
+
+  public:
+    class const_iterator
+    {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = const MyGame::Monster *;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type *;
+        using reference = value_type;
+
+        const_iterator() = default;
+
+        const MyGame::Monster *operator*() const
+        {
+            return m_monsters->Get(m_index);
+        }
+
+        const_iterator &operator++()
+        {
+            ++m_index;
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            const_iterator before = *this;
+            ++m_index;
+            return before;
+        }
+
+        bool operator==(const const_iterator &other) const
+        {
+            return m_index == other.m_index;
+        }
+
+        bool operator!=(const const_iterator &other) const
+        {
+            return m_index != other.m_index;
+        }
+
+      private:
+        friend class MonsterBatchView;
+
+        const_iterator(const Monsters *monsters, flatbuffers::uoffset_t index) : m_monsters(monsters), m_index(index)
+        {
+        }
+
+        const Monsters *m_monsters = nullptr;
+        flatbuffers::uoffset_t m_index = 0;
+    };
+
+    explicit MonsterBatchView(const zmq::message_t &frame, bool verify = true) : m_batch(frame, verify)
+    {
+        m_monsters = m_batch ? m_batch->monsters() : nullptr;
+    }
+
+    MonsterBatchView(const zmq::message_t &frame, const flatbuffers::Verifier::Options &options)
+        : m_batch(frame, options)
+    {
+        m_monsters = m_batch ? m_batch->monsters() : nullptr;
+    }
+
+    // False if the frame is not a valid batch; an empty batch is valid.
+    explicit operator bool() const
+    {
+        return static_cast<bool>(m_batch);
+    }
+
+    size_t size() const
+    {
+        return m_monsters ? m_monsters->size() : 0;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    const MyGame::Monster *operator[](size_t index) const
+    {
+        return m_monsters->Get(static_cast<flatbuffers::uoffset_t>(index));
+    }
+
+    const_iterator begin() const
+    {
+        return const_iterator(m_monsters, 0);
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator(m_monsters, static_cast<flatbuffers::uoffset_t>(size()));
+    }
+
+    const MyGame::MonsterBatch *get() const
+    {
+        return m_batch.get();
+    }
+
+  private:
+    FlatBufferView<MyGame::MonsterBatch> m_batch;
+    const Monsters *m_monsters;
+};
@@ -0,0 +1,185 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+
+#ifndef FLATBUFFERS_GENERATED_MONSTERBATCH_MYGAME_H_
+#define FLATBUFFERS_GENERATED_MONSTERBATCH_MYGAME_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+// Ensure the included flatbuffers.h is the same version as when this file was
+// generated, otherwise it may not be compatible.
+static_assert(FLATBUFFERS_VERSION_MAJOR == 25 &&
+              FLATBUFFERS_VERSION_MINOR == 2 &&
+              FLATBUFFERS_VERSION_REVISION == 10,
+             "Non-compatible flatbuffers version included");
+
+#include "monster_generated.h"
+
+namespace MyGame {
+
+struct MonsterBatch;
+struct MonsterBatchBuilder;
+struct MonsterBatchT;
+
+struct MonsterBatchT : public ::flatbuffers::NativeTable {
+  typedef MonsterBatch TableType;
+  std::vector<std::unique_ptr<MyGame::MonsterT>> monsters{};
+  MonsterBatchT() = default;
+  MonsterBatchT(const MonsterBatchT &o);
+  MonsterBatchT(MonsterBatchT&&) FLATBUFFERS_NOEXCEPT = default;
+  MonsterBatchT &operator=(MonsterBatchT o) FLATBUFFERS_NOEXCEPT;
+};
+
+struct MonsterBatch FLATBUFFERS_FINAL_CLASS : private ::flatbuffers::Table {
+  typedef MonsterBatchT NativeTableType;
+  typedef MonsterBatchBuilder Builder;
+  enum FlatBuffersVTableOffset FLATBUFFERS_VTABLE_UNDERLYING_TYPE {
+    VT_MONSTERS = 4
+  };
+  const ::flatbuffers::Vector<::flatbuffers::Offset<MyGame::Monster>> *monsters() const {
+    return GetPointer<const ::flatbuffers::Vector<::flatbuffers::Offset<MyGame::Monster>> *>(VT_MONSTERS);
+  }
+  bool Verify(::flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_MONSTERS) &&
+           verifier.VerifyVector(monsters()) &&
+           verifier.VerifyVectorOfTables(monsters()) &&
+           verifier.EndTable();
+  }
+  MonsterBatchT *UnPack(const ::flatbuffers::resolver_function_t *_resolver = nullptr) const;
+  void UnPackTo(MonsterBatchT *_o, const ::flatbuffers::resolver_function_t *_resolver = nullptr) const;
+  static ::flatbuffers::Offset<MonsterBatch> Pack(::flatbuffers::FlatBufferBuilder &_fbb, const MonsterBatchT* _o, const ::flatbuffers::rehasher_function_t *_rehasher = nullptr);
+};
+
+struct MonsterBatchBuilder {
+  typedef MonsterBatch Table;
+  ::flatbuffers::FlatBufferBuilder &fbb_;
+  ::flatbuffers::uoffset_t start_;
+  void add_monsters(::flatbuffers::Offset<::flatbuffers::Vector<::flatbuffers::Offset<MyGame::Monster>>> monsters) {
+    fbb_.AddOffset(MonsterBatch::VT_MONSTERS, monsters);
+  }
+  explicit MonsterBatchBuilder(::flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  ::flatbuffers::Offset<MonsterBatch> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = ::flatbuffers::Offset<MonsterBatch>(end);
+    return o;
+  }
+};
+
+inline ::flatbuffers::Offset<MonsterBatch> CreateMonsterBatch(
+    ::flatbuffers::FlatBufferBuilder &_fbb,
+    ::flatbuffers::Offset<::flatbuffers::Vector<::flatbuffers::Offset<MyGame::Monster>>> monsters = 0) {
+  MonsterBatchBuilder builder_(_fbb);
+  builder_.add_monsters(monsters);
+  return builder_.Finish();
+}
+
+inline ::flatbuffers::Offset<MonsterBatch> CreateMonsterBatchDirect(
+    ::flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<::flatbuffers::Offset<MyGame::Monster>> *monsters = nullptr) {
+  auto monsters__ = monsters ? _fbb.CreateVector<::flatbuffers::Offset<MyGame::Monster>>(*monsters) : 0;
+  return MyGame::CreateMonsterBatch(
+      _fbb,
+      monsters__);
+}
+
+::flatbuffers::Offset<MonsterBatch> CreateMonsterBatch(::flatbuffers::FlatBufferBuilder &_fbb, const MonsterBatchT *_o, const ::flatbuffers::rehasher_function_t *_rehasher = nullptr);
+
+inline MonsterBatchT::MonsterBatchT(const MonsterBatchT &o) {
+  monsters.reserve(o.monsters.size());
+  for (const auto &monsters_element : o.monsters) { monsters.emplace_back((monsters_element) ? new MyGame::MonsterT(*monsters_element) : nullptr); }
+}
+
+inline MonsterBatchT &MonsterBatchT::operator=(MonsterBatchT o) FLATBUFFERS_NOEXCEPT {
+  std::swap(monsters, o.monsters);
+  return *this;
+}
+
+inline MonsterBatchT *MonsterBatch::UnPack(const ::flatbuffers::resolver_function_t *_resolver) const {
+  auto _o = std::unique_ptr<MonsterBatchT>(new MonsterBatchT());
+  UnPackTo(_o.get(), _resolver);
+  return _o.release();
+}
+
+inline void MonsterBatch::UnPackTo(MonsterBatchT *_o, const ::flatbuffers::resolver_function_t *_resolver) const {
+  (void)_o;
+  (void)_resolver;
+  { auto _e = monsters(); if (_e) { _o->monsters.resize(_e->size()); for (::flatbuffers::uoffset_t _i = 0; _i < _e->size(); _i++) { if(_o->monsters[_i]) { _e->Get(_i)->UnPackTo(_o->monsters[_i].get(), _resolver); } else { _o->monsters[_i] = std::unique_ptr<MyGame::MonsterT>(_e->Get(_i)->UnPack(_resolver)); }; } } else { _o->monsters.resize(0); } }
+}
+
+inline ::flatbuffers::Offset<MonsterBatch> MonsterBatch::Pack(::flatbuffers::FlatBufferBuilder &_fbb, const MonsterBatchT* _o, const ::flatbuffers::rehasher_function_t *_rehasher) {
+  return CreateMonsterBatch(_fbb, _o, _rehasher);
+}
+
+inline ::flatbuffers::Offset<MonsterBatch> CreateMonsterBatch(::flatbuffers::FlatBufferBuilder &_fbb, const MonsterBatchT *_o, const ::flatbuffers::rehasher_function_t *_rehasher) {
+  (void)_rehasher;
+  (void)_o;
+  struct _VectorArgs { ::flatbuffers::FlatBufferBuilder *__fbb; const MonsterBatchT* __o; const ::flatbuffers::rehasher_function_t *__rehasher; } _va = { &_fbb, _o, _rehasher}; (void)_va;
+  auto _monsters = _o->monsters.size() ? _fbb.CreateVector<::flatbuffers::Offset<MyGame::Monster>> (_o->monsters.size(), [](size_t i, _VectorArgs *__va) { return CreateMonster(*__va->__fbb, __va->__o->monsters[i].get(), __va->__rehasher); }, &_va ) : 0;
+  return MyGame::CreateMonsterBatch(
+      _fbb,
+      _monsters);
+}
+
+inline const MyGame::MonsterBatch *GetMonsterBatch(const void *buf) {
+  return ::flatbuffers::GetRoot<MyGame::MonsterBatch>(buf);
+}
+
+inline const MyGame::MonsterBatch *GetSizePrefixedMonsterBatch(const void *buf) {
+  return ::flatbuffers::GetSizePrefixedRoot<MyGame::MonsterBatch>(buf);
+}
+
+inline const char *MonsterBatchIdentifier() {
+  return "MBAT";
+}
+
+inline bool MonsterBatchBufferHasIdentifier(const void *buf) {
+  return ::flatbuffers::BufferHasIdentifier(
+      buf, MonsterBatchIdentifier());
+}
+
+inline bool SizePrefixedMonsterBatchBufferHasIdentifier(const void *buf) {
+  return ::flatbuffers::BufferHasIdentifier(
+      buf, MonsterBatchIdentifier(), true);
+}
+
+inline bool VerifyMonsterBatchBuffer(
+    ::flatbuffers::Verifier &verifier) {
+  return verifier.VerifyBuffer<MyGame::MonsterBatch>(MonsterBatchIdentifier());
+}
+
+inline bool VerifySizePrefixedMonsterBatchBuffer(
+    ::flatbuffers::Verifier &verifier) {
+  return verifier.VerifySizePrefixedBuffer<MyGame::MonsterBatch>(MonsterBatchIdentifier());
+}
+
+inline void FinishMonsterBatchBuffer(
+    ::flatbuffers::FlatBufferBuilder &fbb,
+    ::flatbuffers::Offset<MyGame::MonsterBatch> root) {
+  fbb.Finish(root, MonsterBatchIdentifier());
+}
+
+inline void FinishSizePrefixedMonsterBatchBuffer(
+    ::flatbuffers::FlatBufferBuilder &fbb,
+    ::flatbuffers::Offset<MyGame::MonsterBatch> root) {
+  fbb.FinishSizePrefixed(root, MonsterBatchIdentifier());
+}
+
+inline std::unique_ptr<MyGame::MonsterBatchT> UnPackMonsterBatch(
+    const void *buf,
+    const ::flatbuffers::resolver_function_t *res = nullptr) {
+  return std::unique_ptr<MyGame::MonsterBatchT>(GetMonsterBatch(buf)->UnPack(res));
+}
+
+inline std::unique_ptr<MyGame::MonsterBatchT> UnPackSizePrefixedMonsterBatch(
+    const void *buf,
+    const ::flatbuffers::resolver_function_t *res = nullptr) {
+  return std::unique_ptr<MyGame::MonsterBatchT>(GetSizePrefixedMonsterBatch(buf)->UnPack(res));
+}
+
+}  // namespace MyGame
+
+#endif  // FLATBUFFERS_GENERATED_MONSTERBATCH_MYGAME_H_
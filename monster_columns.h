@@ -0,0 +1,160 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <zmq.hpp>
+
+#include "column_kernels.h"
+#include "flatbuffer_frame.h"
+#include "monster_batch.h"
+#include "monster_generated.h"
+
+// Monsters transposed into one array per field, the layout the column kernels
+// scan. Row i of every column is the i-th Monster appended. A Monster without
+// a position has NaN coordinates, which the min/max kernels skip.
+//
+// clear() keeps the arrays' capacity, so a stage that reuses one
+// MonsterColumns per batch stops allocating once it has seen the largest one.
+struct MonsterColumns
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<int16_t> hp;
+    std::vector<int16_t> mana;
+    std::vector<int8_t> color;
+
+    size_t size() const
+    {
+        return hp.size();
+    }
+
+    void clear()
+    {
+        x.clear();
+        y.clear();
+        z.clear();
+        hp.clear();
+        mana.clear();
+        color.clear();
+    }
+
+    void reserve(size_t rows)
+    {
+        x.reserve(rows);
+        y.reserve(rows);
+        z.reserve(rows);
+        hp.reserve(rows);
+        mana.reserve(rows);
+        color.reserve(rows);
+    }
+
+    void append(const MyGame::Monster &monster)
+    {
+        constexpr float kMissing = std::numeric_limits<float>::quiet_NaN();
+        const MyGame::Vec3 *pos = monster.pos();
+        x.push_back(pos ? pos->x() : kMissing);
+        y.push_back(pos ? pos->y() : kMissing);
+        z.push_back(pos ? pos->z() : kMissing);
+        hp.push_back(monster.hp());
+        mana.push_back(monster.mana());
+        color.push_back(static_cast<int8_t>(monster.color()));
+    }
+
+    void append(const MonsterBatchView &batch)
+    {
+        reserve(size() + batch.size());
+        for (const MyGame::Monster *monster : batch)
+        {
+            append(*monster);
+        }
+    }
+
+    // Appends the Monster or MonsterBatch in a received frame. Returns false,
+    // appending nothing, if the frame does not verify.
+    bool append(const zmq::message_t &frame, bool verify = true)
+    {
+        if (isMonsterBatch(frame))
+        {
+            const MonsterBatchView batch(frame, verify);
+            if (batch)
+            {
+                append(batch);
+            }
+            return static_cast<bool>(batch);
+        }
+        const FlatBufferView<MyGame::Monster> monster(frame, verify);
+        if (monster)
+        {
+            append(*monster.get());
+        }
+        return static_cast<bool>(monster);
+    }
+};
+
+// The usual summary of a set of Monsters: bounding box, hp and mana ranges
+// and totals, and the number of Monsters of each Color.
+struct MonsterAggregate
+{
+    static constexpr size_t kColors = MyGame::Color_MAX - MyGame::Color_MIN + 1;
+
+    size_t count = 0;
+    Range<float> x = Range<float>::empty();
+    Range<float> y = Range<float>::empty();
+    Range<float> z = Range<float>::empty();
+    Range<int16_t> hp = Range<int16_t>::empty();
+    Range<int16_t> mana = Range<int16_t>::empty();
+    int64_t hpTotal = 0;
+    int64_t manaTotal = 0;
+    // Indexed by Color - Color_MIN.
+    std::array<uint64_t, kColors> colors{};
+
+    static MonsterAggregate of(const MonsterColumns &columns,
+                               const ColumnKernels &kernels = ColumnKernels::best())
+    {
+        const size_t rows = columns.size();
+        MonsterAggregate aggregate;
+        aggregate.count = rows;
+        aggregate.x = kernels.minMaxFloat(columns.x.data(), rows);
+        aggregate.y = kernels.minMaxFloat(columns.y.data(), rows);
+        aggregate.z = kernels.minMaxFloat(columns.z.data(), rows);
+        aggregate.hp = kernels.minMaxShort(columns.hp.data(), rows);
+        aggregate.mana = kernels.minMaxShort(columns.mana.data(), rows);
+        aggregate.hpTotal = kernels.sum(columns.hp.data(), rows);
+        aggregate.manaTotal = kernels.sum(columns.mana.data(), rows);
+        for (size_t i = 0; i < kColors; ++i)
+        {
+            aggregate.colors[i] =
+                kernels.countEqual(columns.color.data(), rows, static_cast<int8_t>(MyGame::Color_MIN + i));
+        }
+        return aggregate;
+    }
+
+    // The same through the generated accessors, one Monster at a time; the
+    // baseline the column path is measured against.
+    void add(const MyGame::Monster &monster)
+    {
+        ++count;
+        if (const MyGame::Vec3 *pos = monster.pos())
+        {
+            x.add(pos->x());
+            y.add(pos->y());
+            z.add(pos->z());
+        }
+        hp.add(monster.hp());
+        mana.add(monster.mana());
+        hpTotal += monster.hp();
+        manaTotal += monster.mana();
+        const int color = monster.color() - MyGame::Color_MIN;
+        if (color >= 0 && static_cast<size_t>(color) < kColors)
+        {
+            ++colors[color];
+        }
+    }
+
+    bool operator==(const MonsterAggregate &) const = default;
+};
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <utility>
+
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Spin-then-block policy for one consumer, which blocks by its own means
+// once spin() comes back empty. The spin budget adapts to the producers: it
+// grows while spinning keeps finding items and shrinks when the consumer
+// ends up sleeping anyway, so a steady stream is picked up without a wakeup
+// and an idle consumer costs little CPU before it blocks.
+class AdaptiveSpin
+{
+  public:
+    static constexpr unsigned kMinSpins = 16;
+    static constexpr unsigned kMaxSpins = 16384;
+
+    unsigned spins() const
+    {
+        return m_spins;
+    }
+
+    // Polls `size_t attempt()` until it returns a non-zero count or the
+    // budget runs out, pausing between polls and yielding the CPU every 64th
+    // one. Returns 0 when the caller should block.
+    template <typename Attempt> size_t spin(Attempt &&attempt)
+    {
+        for (unsigned i = 0; i < m_spins; ++i)
+        {
+            if ((i & 63) == 63)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                cpuRelax();
+            }
+            if (const size_t count = attempt())
+            {
+                m_spins = std::min(kMaxSpins, m_spins * 2);
+                return count;
+            }
+        }
+        m_spins = std::max(kMinSpins, m_spins / 2);
+        return 0;
+    }
+
+  private:
+    unsigned m_spins = 256;
+};
+
+// Bounded multi-producer/multi-consumer queue storing items by value
+// (D. Vyukov's sequence-numbered ring). Enqueue and dequeue are lock-free
+// and never wait for items; a producer only touches the mutex when it has to
+// sleep because the queue is full, and consumers only take it to wake such a
+// producer. Consumers that wait for items do so outside the queue, see
+// AdaptiveSpin.
+template <typename T> class MpmcQueue
+{
+  public:
+    // `capacity` is rounded up to a power of two.
+    explicit MpmcQueue(size_t capacity) : m_capacity(roundUp(capacity)), m_mask(m_capacity - 1)
+    {
+        m_cells.reset(new Cell[m_capacity]);
+        for (size_t i = 0; i < m_capacity; ++i)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcQueue(const MpmcQueue &) = delete;
+    MpmcQueue &operator=(const MpmcQueue &) = delete;
+
+    bool tryEnqueue(T &&item)
+    {
+        return push(item);
+    }
+
+    bool tryDequeue(T &item)
+    {
+        if (!pop(item))
+        {
+            return false;
+        }
+        wakeProducer();
+        return true;
+    }
+
+    // Blocks while the queue is full.
+    void enqueue(T &&item)
+    {
+        if (!tryEnqueue(std::move(item)))
+        {
+            sleepUntilPushed(item);
+        }
+    }
+
+    // Moves up to `out.size()` items into `out` with a single claim on the
+    // queue and wakes at most one blocked producer for the whole batch.
+    // Returns the number of items taken.
+    size_t tryDequeueBatch(std::span<T> out)
+    {
+        const size_t count = popBatch(out);
+        if (count != 0)
+        {
+            wakeProducer();
+        }
+        return count;
+    }
+
+    // Approximate when other threads are active.
+    size_t size() const
+    {
+        const size_t enqueued = m_enqueuePos.load(std::memory_order_relaxed);
+        const size_t dequeued = m_dequeuePos.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    size_t capacity() const
+    {
+        return m_capacity;
+    }
+
+  private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    static size_t roundUp(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    // Moves from `item` only on success.
+    bool push(T &item)
+    {
+        size_t position = m_enqueuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = m_cells[position & m_mask];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (diff == 0)
+            {
+                if (m_enqueuePos.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    cell.item = std::move(item);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(T &item)
+    {
+        size_t position = m_dequeuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell &cell = m_cells[position & m_mask];
+            const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+            if (diff == 0)
+            {
+                if (m_dequeuePos.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    item = std::move(cell.item);
+                    cell.sequence.store(position + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Claims the longest run of consecutive published cells, up to
+    // `out.size()`, with one CAS. A cell seen as published stays so until
+    // its position is claimed, which would make the CAS fail.
+    size_t popBatch(std::span<T> out)
+    {
+        size_t position = m_dequeuePos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            size_t count = 0;
+            while (count < out.size())
+            {
+                const Cell &cell = m_cells[(position + count) & m_mask];
+                if (cell.sequence.load(std::memory_order_acquire) != position + count + 1)
+                {
+                    break;
+                }
+                ++count;
+            }
+            if (count == 0)
+            {
+                // Either empty or another consumer got there first; only retry
+                // in the latter case.
+                const size_t current = m_dequeuePos.load(std::memory_order_relaxed);
+                if (current == position)
+                {
+                    return 0;
+                }
+                position = current;
+                continue;
+            }
+            if (m_dequeuePos.compare_exchange_weak(position, position + count, std::memory_order_relaxed))
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    Cell &cell = m_cells[(position + i) & m_mask];
+                    out[i] = std::move(cell.item);
+                    cell.sequence.store(position + i + m_mask + 1, std::memory_order_release);
+                }
+                return count;
+            }
+        }
+    }
+
+    // Runs after every successful dequeue, outside the mutex; costs one load
+    // unless a producer is asleep.
+    void wakeProducer()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_notFullWaiters.load(std::memory_order_relaxed) != 0)
+        {
+            // Taking the mutex orders this notify after the sleeper's last
+            // attempt, so the wakeup cannot be lost.
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_notFull.notify_one();
+        }
+    }
+
+    // Retries the push under the mutex and sleeps between attempts.
+    void sleepUntilPushed(T &item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFullWaiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!push(item))
+        {
+            m_notFull.wait(lock);
+        }
+        m_notFullWaiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    const size_t m_capacity;
+    const size_t m_mask;
+    std::unique_ptr<Cell[]> m_cells;
+
+    alignas(64) std::atomic<size_t> m_enqueuePos{0};
+    alignas(64) std::atomic<size_t> m_dequeuePos{0};
+
+    alignas(64) std::atomic<int> m_notFullWaiters{0};
+    std::mutex m_mutex;
+    std::condition_variable m_notFull;
+};
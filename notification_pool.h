@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "Poco/AutoPtr.h"
+
+#include "mpmc_queue.h"
+
+template <typename T> class NotificationPool;
+
+// A pooled notification carrying a `T` payload. The reference count lives in
+// the object, so it is held through Poco::AutoPtr like any Poco notification;
+// when the last reference is released the object goes back to its pool with
+// the payload untouched, so a string or vector payload keeps its capacity for
+// the next use.
+template <typename T> class PooledNotification
+{
+  public:
+    using Ptr = Poco::AutoPtr<PooledNotification>;
+
+    PooledNotification(const PooledNotification &) = delete;
+    PooledNotification &operator=(const PooledNotification &) = delete;
+
+    T &payload()
+    {
+        return m_payload;
+    }
+
+    const T &payload() const
+    {
+        return m_payload;
+    }
+
+    void duplicate() const
+    {
+        m_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release() const
+    {
+        if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            m_pool.recycle(const_cast<PooledNotification *>(this));
+        }
+    }
+
+  private:
+    friend class NotificationPool<T>;
+
+    explicit PooledNotification(NotificationPool<T> &pool) : m_pool(pool)
+    {
+    }
+
+    mutable std::atomic<int> m_refs{0};
+    NotificationPool<T> &m_pool;
+    T m_payload;
+};
+
+// Fixed set of preallocated notifications shared by any number of producer
+// and consumer threads. acquire() takes one from a lock-free free list; if
+// the list is empty a new one is allocated (a miss). Released notifications
+// return to the free list, or are deleted if it is already full, so idle
+// notifications never exceed the capacity (rounded up to a power of two).
+//
+// The pool must outlive every notification acquired from it.
+template <typename T> class NotificationPool
+{
+  public:
+    using Notification = PooledNotification<T>;
+    using Ptr = typename Notification::Ptr;
+
+    struct Stats
+    {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t discarded;
+        size_t available;
+    };
+
+    explicit NotificationPool(size_t capacity) : m_free(capacity)
+    {
+        for (size_t i = 0; i < capacity; ++i)
+        {
+            Notification *notification = new Notification(*this);
+            m_free.tryEnqueue(std::move(notification));
+        }
+    }
+
+    ~NotificationPool()
+    {
+        Notification *notification;
+        while (m_free.tryDequeue(notification))
+        {
+            delete notification;
+        }
+    }
+
+    NotificationPool(const NotificationPool &) = delete;
+    NotificationPool &operator=(const NotificationPool &) = delete;
+
+    Ptr acquire()
+    {
+        Notification *notification;
+        if (m_free.tryDequeue(notification))
+        {
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            m_misses.fetch_add(1, std::memory_order_relaxed);
+            notification = new Notification(*this);
+        }
+        return Ptr(notification, true);
+    }
+
+    Stats stats() const
+    {
+        return {m_hits.load(std::memory_order_relaxed), m_misses.load(std::memory_order_relaxed),
+                m_discarded.load(std::memory_order_relaxed), m_free.size()};
+    }
+
+  private:
+    friend class PooledNotification<T>;
+
+    void recycle(Notification *notification)
+    {
+        if (!m_free.tryEnqueue(std::move(notification)))
+        {
+            m_discarded.fetch_add(1, std::memory_order_relaxed);
+            delete notification;
+        }
+    }
+
+    MpmcQueue<Notification *> m_free;
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+    std::atomic<uint64_t> m_discarded{0};
+};
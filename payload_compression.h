@@ -0,0 +1,288 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Poco/StringTokenizer.h"
+#include "Poco/Util/AbstractConfiguration.h"
+
+#include <zmq.hpp>
+
+#ifdef POCOEX_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "broker_metrics.h"
+#include "zmq_forwarder.h"
+
+struct CompressSettings
+{
+    bool enabled = false;
+    // Topic prefixes to compress, all topics if empty.
+    std::vector<std::string> topics;
+    // Payload frames smaller than this are sent as they are.
+    size_t minBytes = 1024;
+    // A compressed frame must come down to this share of the original size,
+    // otherwise the original is sent.
+    double maxRatio = 0.9;
+    // LZ4_compress_fast acceleration: higher is faster and compresses less.
+    int acceleration = 1;
+
+    static CompressSettings fromConfig(const Poco::Util::AbstractConfiguration &config)
+    {
+        CompressSettings settings;
+        settings.enabled = config.getBool("compress.enable", settings.enabled);
+        Poco::StringTokenizer topics(config.getString("compress.topics", ""), ",",
+                                     Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+        settings.topics.assign(topics.begin(), topics.end());
+        settings.minBytes = std::max(0, config.getInt("compress.min_bytes", static_cast<int>(settings.minBytes)));
+        settings.maxRatio = std::clamp(config.getDouble("compress.max_ratio", settings.maxRatio), 0.0, 1.0);
+        settings.acceleration = std::max(1, config.getInt("compress.acceleration", settings.acceleration));
+        return settings;
+    }
+};
+
+// The frame the broker inserts right after the topic of every message of a
+// topic it compresses: the magic "PLZ4", then one little-endian uint32 per
+// payload frame, the frame's original size if it is an LZ4 block or 0 if it
+// was sent as it is. Whether a frame is compressed is never read from the
+// frame itself, so a payload can hold any bytes.
+struct CompressionHeader
+{
+    static constexpr char kMagic[4] = {'P', 'L', 'Z', '4'};
+
+    static size_t bytesFor(size_t payloadFrames)
+    {
+        return sizeof(kMagic) + sizeof(uint32_t) * payloadFrames;
+    }
+
+    static bool is(const zmq::message_t &frame, size_t payloadFrames)
+    {
+        return frame.size() == bytesFor(payloadFrames) && std::memcmp(frame.data(), kMagic, sizeof(kMagic)) == 0;
+    }
+
+    // Original size of payload frame `index`, 0 if it is not compressed.
+    static uint32_t originalSize(const zmq::message_t &header, size_t index)
+    {
+        const unsigned char *at = static_cast<const unsigned char *>(header.data()) + bytesFor(index);
+        return uint32_t(at[0]) | uint32_t(at[1]) << 8 | uint32_t(at[2]) << 16 | uint32_t(at[3]) << 24;
+    }
+
+    static void start(std::vector<char> &header, size_t payloadFrames)
+    {
+        header.assign(bytesFor(payloadFrames), 0);
+        std::memcpy(header.data(), kMagic, sizeof(kMagic));
+    }
+
+    static void setOriginalSize(std::vector<char> &header, size_t index, uint32_t size)
+    {
+        char *at = header.data() + bytesFor(index);
+        for (int i = 0; i < 4; ++i)
+        {
+            at[i] = static_cast<char>(size >> (8 * i));
+        }
+    }
+};
+
+// Subscriber side. The contract: for a topic the broker compresses (one of
+// its compress.topics, or any topic if that is empty, with compression
+// active as logged at startup) every message is [topic][CompressionHeader]
+// [payload frames...], whether or not any frame shrank; messages of other
+// topics arrive exactly as published. A subscriber calls this only for
+// messages of compressed topics. It restores the payload frames and removes
+// the header, and returns false, leaving the message unusable, if the header
+// is missing or a frame does not decompress, or if this build has no LZ4 and
+// a frame is compressed.
+//
+//   if (compressed(topic) && !decompressMessage(message)) { /* drop it */ }
+inline bool decompressMessage(Multipart &message)
+{
+    if (message.size() < 2 || !CompressionHeader::is(message[1], message.size() - 2))
+    {
+        return false;
+    }
+    const zmq::message_t &header = message[1];
+    for (size_t i = 0; i + 2 < message.size(); ++i)
+    {
+        const uint32_t size = CompressionHeader::originalSize(header, i);
+        if (size == 0)
+        {
+            continue;
+        }
+#ifdef POCOEX_HAVE_LZ4
+        zmq::message_t &frame = message[i + 2];
+        if (size > static_cast<uint32_t>(LZ4_MAX_INPUT_SIZE))
+        {
+            return false;
+        }
+        zmq::message_t original(size);
+        const int decoded =
+            LZ4_decompress_safe(static_cast<const char *>(frame.data()), static_cast<char *>(original.data()),
+                                static_cast<int>(frame.size()), static_cast<int>(size));
+        if (decoded < 0 || static_cast<uint32_t>(decoded) != size)
+        {
+            return false;
+        }
+        frame.move(original);
+#else
+        return false;
+#endif
+    }
+    message.erase(1);
+    return true;
+}
+
+// Last stage before XPUB: compresses the payload frames (all but the topic)
+// of selected topics with LZ4. A frame below compress.min_bytes, or whose
+// compressed form is not below compress.max_ratio of it, goes out unchanged.
+// A topic whose payloads keep compressing poorly is left alone for the next
+// 2, 4, ... up to 256 frames before the broker tries again, so incompressible
+// streams cost little CPU.
+//
+// Every message of a selected topic gets a CompressionHeader, see
+// decompressMessage() for the subscriber's side. Only used when XPUB is on a
+// tcp endpoint: ipc and inproc peers share the host and gain nothing.
+// Runs on the thread that owns `metrics`.
+class PayloadCompressor
+{
+  public:
+    PayloadCompressor(const CompressSettings &settings, const std::string &endpoint, BrokerMetrics &metrics,
+                      bool timed)
+        : m_settings(settings), m_enabled(settings.enabled && available() && appliesTo(endpoint)),
+          m_metrics(metrics), m_timed(timed), m_backoff{}, m_scratch{}, m_header{}
+    {
+    }
+
+    static bool available()
+    {
+#ifdef POCOEX_HAVE_LZ4
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    static bool appliesTo(const std::string &endpoint)
+    {
+        return endpoint.rfind("tcp://", 0) == 0;
+    }
+
+    bool enabled() const
+    {
+        return m_enabled;
+    }
+
+    void compress(Multipart &message)
+    {
+        if (!m_enabled || message.size() < 2 || !selected(message.front()))
+        {
+            return;
+        }
+        const uint64_t hash = topicHash(message.front());
+        Backoff &backoff = m_backoff[hash % kBackoffSlots];
+        if (backoff.hash != hash)
+        {
+            backoff = Backoff{hash, 0, 0};
+        }
+        CompressionHeader::start(m_header, message.size() - 1);
+        for (size_t i = 1; i < message.size(); ++i)
+        {
+            zmq::message_t &frame = message[i];
+            if (frame.size() < m_settings.minBytes)
+            {
+                continue;
+            }
+            if (backoff.skip != 0)
+            {
+                --backoff.skip;
+                continue;
+            }
+            const uint32_t original = static_cast<uint32_t>(frame.size());
+            if (compressFrame(frame))
+            {
+                CompressionHeader::setOriginalSize(m_header, i - 1, original);
+                backoff.misses = 0;
+            }
+            else
+            {
+                backoff.misses = std::min<uint32_t>(backoff.misses + 1, 8);
+                backoff.skip = 1u << backoff.misses;
+            }
+        }
+        message.insert(1, m_header.data(), m_header.size());
+    }
+
+  private:
+    static constexpr size_t kBackoffSlots = 256;
+
+    struct Backoff
+    {
+        uint64_t hash;
+        // Frames of the topic to send unchanged before trying again.
+        uint32_t skip;
+        // Poor results in a row.
+        uint32_t misses;
+    };
+
+    bool selected(const zmq::message_t &topic) const
+    {
+        if (m_settings.topics.empty())
+        {
+            return true;
+        }
+        const std::string_view name = topic.to_string_view();
+        return std::any_of(m_settings.topics.begin(), m_settings.topics.end(),
+                           [name](const std::string &prefix) { return name.starts_with(prefix); });
+    }
+
+    // Returns false if the frame was left as it was.
+    bool compressFrame(zmq::message_t &frame)
+    {
+#ifdef POCOEX_HAVE_LZ4
+        if (frame.size() > static_cast<size_t>(LZ4_MAX_INPUT_SIZE))
+        {
+            return false;
+        }
+        const uint64_t start = m_timed ? monotonicNanos() : 0;
+        const int size = static_cast<int>(frame.size());
+        m_scratch.resize(static_cast<size_t>(LZ4_compressBound(size)));
+        const int compressed = LZ4_compress_fast(static_cast<const char *>(frame.data()), m_scratch.data(), size,
+                                                 LZ4_compressBound(size), m_settings.acceleration);
+        const size_t total = static_cast<size_t>(std::max(compressed, 0));
+        const bool kept = compressed > 0 && static_cast<double>(total) <= m_settings.maxRatio * size;
+        if (kept)
+        {
+            frame.rebuild(m_scratch.data(), total);
+            bump(m_metrics.compressed);
+            bump(m_metrics.compressIn, static_cast<uint64_t>(size));
+            bump(m_metrics.compressOut, total);
+        }
+        else
+        {
+            bump(m_metrics.compressSkipped);
+        }
+        if (m_timed)
+        {
+            m_metrics.compressLatency.record(monotonicNanos() - start);
+        }
+        return kept;
+#else
+        (void)frame;
+        return false;
+#endif
+    }
+
+    CompressSettings m_settings;
+    const bool m_enabled;
+    BrokerMetrics &m_metrics;
+    const bool m_timed;
+    // Direct-mapped by topic hash; a topic that lands on a taken slot starts over.
+    std::array<Backoff, kBackoffSlots> m_backoff;
+    std::vector<char> m_scratch;
+    std::vector<char> m_header;
+};
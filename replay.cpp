@@ -0,0 +1,640 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "Poco/DirectoryIterator.h"
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+#include "Poco/Path.h"
+
+#include <flatbuffers/flatbuffers.h>
+#include <zmq.hpp>
+
+#include "broker_metrics.h"
+#include "capture_log.h"
+#include "flatbuffer_frame.h"
+#include "monster_batch.h"
+#include "monster_generated.h"
+#include "zmq_forwarder.h"
+
+// Load generator for the broker's XSUB port. Publishes either the messages of
+// capture files written by the broker (capture.enable) or a synthetic stream
+// of Monsters, from several PUB sockets on their own threads, and prints one
+// JSON summary line when done.
+//
+//   pocoex_replay [key=value ...]
+//
+//   source=monster               capture or monster
+//   frontend=tcp://127.0.0.1:5555 the broker's XSUB endpoint
+//   publishers=4                 publisher threads; a topic always goes
+//                                through the same publisher
+//   io_threads=1                 libzmq I/O threads
+//   warmup=500                   milliseconds between connecting and the
+//                                first message, for subscriptions to arrive
+//
+// source=capture:
+//   capture=capture              .cap files and/or directories holding them;
+//                                the segments of all shards are merged by time
+//   speed=1                      1 for the original timing, 2 for twice as
+//                                fast, 0 for as fast as possible
+//   from=0 to=0                  epoch microseconds to start and stop at, 0
+//                                for the whole capture; `from` uses the index
+//   loops=1                      passes over the capture, 0 for forever
+//
+// source=monster:
+//   messages=1000000             Monsters published in total, 0 for no limit
+//   duration=0                   seconds to run for, 0 for no limit
+//   rate=0                       Monsters per second over all publishers, 0
+//                                for as fast as possible
+//   size=64                      inventory bytes per Monster
+//   batch=0                      Monsters per MonsterBatch, 0 to send them
+//                                one per message
+//   topics=64                    distinct topics, named replay/<n>
+//   distribution=uniform         uniform or zipf
+//   skew=1.0                     zipf exponent
+//   rotate=0                     seconds after which the zipf ranking moves on
+//                                by one topic, so the hot topics change over
+//                                time; 0 to keep it fixed
+//
+// PUB filters by subscription, so only topics some subscriber of the broker
+// wants are sent at all. Sends block rather than drop when the broker falls
+// behind (ZMQ_XPUB_NODROP), so timing slips instead of messages being lost;
+// the summary reports how late messages went out against their schedule.
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::string source = "monster";
+    std::string frontend = "tcp://127.0.0.1:5555";
+    size_t publishers = 4;
+    int ioThreads = 1;
+    long warmup = 500;
+
+    std::vector<std::string> capture{"capture"};
+    double speed = 1.0;
+    int64_t from = 0;
+    int64_t to = 0;
+    uint64_t loops = 1;
+
+    uint64_t messages = 1000000;
+    double duration = 0.0;
+    uint64_t rate = 0;
+    size_t size = 64;
+    size_t batch = 0;
+    size_t topics = 64;
+    std::string distribution = "uniform";
+    double skew = 1.0;
+    double rotate = 0.0;
+};
+
+std::vector<std::string> split(const std::string &list)
+{
+    std::vector<std::string> items;
+    std::istringstream in(list);
+    for (std::string item; std::getline(in, item, ',');)
+    {
+        if (!item.empty())
+        {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+Options parseOptions(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const size_t eq = arg.find('=');
+        const std::string key = arg.substr(0, eq);
+        const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        const uint64_t number = std::strtoull(value.c_str(), nullptr, 10);
+
+        if (key == "source" && (value == "capture" || value == "monster"))
+        {
+            options.source = value;
+        }
+        else if (key == "frontend")
+        {
+            options.frontend = value;
+        }
+        else if (key == "publishers")
+        {
+            options.publishers = std::max<size_t>(1, number);
+        }
+        else if (key == "io_threads")
+        {
+            options.ioThreads = static_cast<int>(std::max<uint64_t>(1, number));
+        }
+        else if (key == "warmup")
+        {
+            options.warmup = static_cast<long>(number);
+        }
+        else if (key == "capture")
+        {
+            options.capture = split(value);
+        }
+        else if (key == "speed")
+        {
+            options.speed = std::max(0.0, std::strtod(value.c_str(), nullptr));
+        }
+        else if (key == "from")
+        {
+            options.from = std::strtoll(value.c_str(), nullptr, 10);
+        }
+        else if (key == "to")
+        {
+            options.to = std::strtoll(value.c_str(), nullptr, 10);
+        }
+        else if (key == "loops")
+        {
+            options.loops = number;
+        }
+        else if (key == "messages")
+        {
+            options.messages = number;
+        }
+        else if (key == "duration")
+        {
+            options.duration = std::max(0.0, std::strtod(value.c_str(), nullptr));
+        }
+        else if (key == "rate")
+        {
+            options.rate = number;
+        }
+        else if (key == "size")
+        {
+            options.size = number;
+        }
+        else if (key == "batch")
+        {
+            options.batch = number;
+        }
+        else if (key == "topics")
+        {
+            options.topics = std::max<size_t>(1, number);
+        }
+        else if (key == "distribution" && (value == "uniform" || value == "zipf"))
+        {
+            options.distribution = value;
+        }
+        else if (key == "skew")
+        {
+            options.skew = std::strtod(value.c_str(), nullptr);
+        }
+        else if (key == "rotate")
+        {
+            options.rotate = std::max(0.0, std::strtod(value.c_str(), nullptr));
+        }
+        else
+        {
+            std::cerr << "unknown option: " << arg << std::endl;
+            std::exit(64);
+        }
+    }
+    return options;
+}
+
+struct PublisherResult
+{
+    uint64_t sent = 0;
+    uint64_t bytes = 0;
+    // How far behind schedule messages went out, in nanoseconds.
+    LatencyHistogram lateness;
+};
+
+// Sleeps through long gaps and spins the last stretch, which keeps the
+// schedule to a few microseconds without burning a core on slow streams.
+void waitUntil(Clock::time_point due)
+{
+    for (;;)
+    {
+        const Clock::time_point now = Clock::now();
+        if (now >= due)
+        {
+            return;
+        }
+        if (due - now > std::chrono::milliseconds(2))
+        {
+            std::this_thread::sleep_for(due - now - std::chrono::milliseconds(1));
+        }
+    }
+}
+
+void recordLateness(PublisherResult &result, Clock::time_point due)
+{
+    const Clock::time_point now = Clock::now();
+    result.lateness.record(now > due ? static_cast<uint64_t>((now - due).count()) : 0);
+}
+
+zmq::socket_t connectPublisher(zmq::context_t &context, const Options &options)
+{
+    zmq::socket_t pub(context, ZMQ_PUB);
+    pub.set(zmq::sockopt::linger, 0);
+    pub.set(zmq::sockopt::xpub_nodrop, 1);
+    pub.connect(options.frontend);
+    return pub;
+}
+
+// The segments of one shard of one capture run, in order.
+struct CaptureStream
+{
+    std::vector<std::string> segments;
+    size_t segment = 0;
+    std::unique_ptr<CaptureReader> reader;
+    CaptureReader::Record record;
+    bool ready = false;
+
+    // Makes `record` the next record, opening the next segment as needed.
+    bool advance(int64_t from)
+    {
+        ready = false;
+        while (!ready)
+        {
+            if (!reader)
+            {
+                if (segment == segments.size())
+                {
+                    return false;
+                }
+                reader.reset(new CaptureReader(segments[segment++]));
+                if (from != 0)
+                {
+                    reader->seek(from);
+                }
+            }
+            ready = reader->next(record);
+            if (!ready)
+            {
+                reader.reset();
+            }
+        }
+        return true;
+    }
+
+    void restart()
+    {
+        segment = 0;
+        reader.reset();
+        ready = false;
+    }
+};
+
+// Capture files are named <run>-s<shard>-<sequence>.cap; returns them
+// grouped into one stream per run and shard.
+std::vector<CaptureStream> findStreams(const std::vector<std::string> &locations)
+{
+    std::vector<std::string> files;
+    for (const std::string &location : locations)
+    {
+        if (Poco::File(location).isDirectory())
+        {
+            for (Poco::DirectoryIterator it(location), end; it != end; ++it)
+            {
+                if (it.path().getExtension() == "cap" && it->isFile())
+                {
+                    files.push_back(it.path().toString());
+                }
+            }
+        }
+        else
+        {
+            files.push_back(location);
+        }
+    }
+
+    std::map<std::string, std::map<uint64_t, std::string>> runs;
+    for (const std::string &file : files)
+    {
+        const std::string name = Poco::Path(file).getBaseName();
+        const size_t dash = name.rfind('-');
+        const std::string stream = dash == std::string::npos ? name : name.substr(0, dash);
+        const uint64_t sequence = dash == std::string::npos ? 0 : std::strtoull(name.c_str() + dash + 1, nullptr, 10);
+        runs[stream][sequence] = file;
+    }
+
+    std::vector<CaptureStream> streams;
+    for (const auto &[name, segments] : runs)
+    {
+        streams.emplace_back();
+        for (const auto &[sequence, file] : segments)
+        {
+            streams.back().segments.push_back(file);
+        }
+    }
+    return streams;
+}
+
+int64_t firstCaptureTime(std::vector<CaptureStream> streams, int64_t from)
+{
+    int64_t first = std::numeric_limits<int64_t>::max();
+    for (CaptureStream &stream : streams)
+    {
+        if (stream.advance(from))
+        {
+            first = std::min(first, stream.record.time);
+        }
+    }
+    return first;
+}
+
+// Replays every record whose topic belongs to publisher `index`, merging the
+// streams by capture time.
+void runCapturePublisher(zmq::context_t &context, const Options &options, size_t index, int64_t first,
+                         Clock::time_point start, PublisherResult &result)
+{
+    zmq::socket_t pub = connectPublisher(context, options);
+    std::vector<CaptureStream> streams = findStreams(options.capture);
+    int64_t lastTime = first;
+    // Capture time at which the current loop starts, relative to `start`.
+    int64_t loopOffset = 0;
+    // Paced or not, nothing goes out before the subscribers are connected.
+    waitUntil(start);
+
+    for (uint64_t loop = 0; options.loops == 0 || loop < options.loops; ++loop)
+    {
+        for (CaptureStream &stream : streams)
+        {
+            stream.restart();
+            stream.advance(options.from);
+        }
+
+        for (;;)
+        {
+            CaptureStream *next = nullptr;
+            for (CaptureStream &stream : streams)
+            {
+                if (stream.ready && (!next || stream.record.time < next->record.time))
+                {
+                    next = &stream;
+                }
+            }
+            if (!next || (options.to != 0 && next->record.time > options.to))
+            {
+                break;
+            }
+
+            const CaptureReader::Record &record = next->record;
+            lastTime = std::max(lastTime, record.time);
+            const std::vector<CaptureReader::Frame> &frames = record.frames;
+            if (!frames.empty() &&
+                topicHash(std::string_view(frames[0].data, frames[0].size)) % options.publishers == index)
+            {
+                Clock::time_point due = start;
+                if (options.speed > 0)
+                {
+                    const double micros = static_cast<double>(loopOffset + record.time - first) / options.speed;
+                    due += std::chrono::microseconds(static_cast<int64_t>(micros));
+                    waitUntil(due);
+                }
+                for (size_t i = 0; i < frames.size(); ++i)
+                {
+                    zmq::message_t frame(frames[i].data, frames[i].size);
+                    pub.send(frame, i + 1 < frames.size() ? zmq::send_flags::sndmore : zmq::send_flags::none);
+                    result.bytes += frames[i].size;
+                }
+                if (options.speed > 0)
+                {
+                    recordLateness(result, due);
+                }
+                ++result.sent;
+            }
+            next->advance(0);
+        }
+        // The next pass follows the last message of this one by a millisecond.
+        loopOffset += lastTime - first + 1000;
+        lastTime = first;
+    }
+}
+
+// Ranks topics for the zipf distribution; `cdf[i]` is the probability of
+// rank <= i.
+std::vector<double> zipfCdf(size_t topics, double skew)
+{
+    std::vector<double> cdf(topics);
+    double total = 0;
+    for (size_t i = 0; i < topics; ++i)
+    {
+        total += 1.0 / std::pow(static_cast<double>(i + 1), skew);
+        cdf[i] = total;
+    }
+    for (double &p : cdf)
+    {
+        p /= total;
+    }
+    return cdf;
+}
+
+void runMonsterPublisher(zmq::context_t &context, const Options &options, size_t index, Clock::time_point start,
+                         PublisherResult &result)
+{
+    zmq::socket_t pub = connectPublisher(context, options);
+
+    std::vector<std::string> topics;
+    for (size_t i = 0; i < options.topics; ++i)
+    {
+        topics.push_back("replay/" + std::to_string(i));
+    }
+    const std::vector<double> cdf = zipfCdf(options.topics, options.skew);
+    const bool zipf = options.distribution == "zipf";
+
+    std::mt19937_64 random(index + 1);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::uniform_int_distribution<int16_t> points(0, 200);
+    std::uniform_real_distribution<float> coordinate(-1000.0f, 1000.0f);
+    const std::vector<uint8_t> inventory(options.size);
+
+    // Every publisher owns a share of the total message count and rate.
+    const size_t publishers = options.publishers;
+    const uint64_t messages =
+        options.messages == 0 ? 0 : options.messages / publishers + (index < options.messages % publishers ? 1 : 0);
+    const double rate = static_cast<double>(options.rate) / static_cast<double>(publishers);
+    const Clock::time_point stop =
+        options.duration > 0 ? start + std::chrono::microseconds(static_cast<int64_t>(options.duration * 1e6))
+                             : Clock::time_point::max();
+
+    // One batcher per topic, created on first use.
+    BatchSettings batchSettings;
+    batchSettings.maxMonsters = std::max<size_t>(1, options.batch);
+    batchSettings.maxBytes = std::max(batchSettings.maxBytes, batchSettings.maxMonsters * (options.size + 64));
+    std::vector<std::unique_ptr<MonsterBatcher>> batchers(options.topics);
+    flatbuffers::FlatBufferBuilder builder(1024, &RecyclingAllocator::shared());
+
+    // Without a rate the loop never waits, so the warmup is kept here.
+    waitUntil(start);
+    for (uint64_t i = 0; messages == 0 || i < messages; ++i)
+    {
+        Clock::time_point due = start;
+        if (rate > 0)
+        {
+            due += std::chrono::nanoseconds(static_cast<int64_t>(static_cast<double>(i) * 1e9 / rate));
+            waitUntil(due);
+        }
+        const Clock::time_point now = Clock::now();
+        if (now >= stop)
+        {
+            break;
+        }
+
+        size_t rank = 0;
+        if (zipf)
+        {
+            rank = static_cast<size_t>(std::lower_bound(cdf.begin(), cdf.end(), unit(random)) - cdf.begin());
+            rank = std::min(rank, options.topics - 1);
+            if (options.rotate > 0)
+            {
+                const double elapsed = std::chrono::duration<double>(now - start).count();
+                rank += static_cast<size_t>(elapsed / options.rotate);
+            }
+        }
+        else
+        {
+            rank = static_cast<size_t>(random() % options.topics);
+        }
+        const size_t topicIndex = rank % options.topics;
+        const std::string &topic = topics[topicIndex];
+
+        if (options.batch && !batchers[topicIndex])
+        {
+            const auto send = [&pub, &result, &topics, topicIndex](zmq::message_t &&batch, size_t) {
+                result.bytes += topics[topicIndex].size() + batch.size();
+                pub.send(zmq::buffer(topics[topicIndex]), zmq::send_flags::sndmore);
+                pub.send(batch, zmq::send_flags::none);
+            };
+            batchers[topicIndex].reset(new MonsterBatcher(batchSettings, send));
+        }
+        flatbuffers::FlatBufferBuilder &target = options.batch ? batchers[topicIndex]->builder() : builder;
+        const auto name = target.CreateString(topic);
+        const auto items = target.CreateVector(inventory.data(), inventory.size());
+        const MyGame::Vec3 pos(coordinate(random), coordinate(random), coordinate(random));
+        MyGame::MonsterBuilder monster(target);
+        monster.add_pos(&pos);
+        monster.add_hp(points(random));
+        monster.add_mana(points(random));
+        monster.add_name(name);
+        monster.add_inventory(items);
+
+        if (options.batch)
+        {
+            batchers[topicIndex]->add(monster.Finish());
+        }
+        else
+        {
+            MyGame::FinishMonsterBuffer(builder, monster.Finish());
+            result.bytes += topic.size() + builder.GetSize();
+            pub.send(zmq::buffer(topic), zmq::send_flags::sndmore);
+            pub.send(releaseFrame(builder), zmq::send_flags::none);
+        }
+        if (rate > 0)
+        {
+            recordLateness(result, due);
+            // Paced batches would otherwise wait for maxMonsters.
+            for (const std::unique_ptr<MonsterBatcher> &batcher : batchers)
+            {
+                if (batcher)
+                {
+                    batcher->flushIfDue();
+                }
+            }
+        }
+        ++result.sent;
+    }
+    for (const std::unique_ptr<MonsterBatcher> &batcher : batchers)
+    {
+        if (batcher)
+        {
+            batcher->flush();
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const Options options = parseOptions(argc, argv);
+    zmq::context_t context(options.ioThreads);
+
+    int64_t first = 0;
+    if (options.source == "capture")
+    {
+        try
+        {
+            first = firstCaptureTime(findStreams(options.capture), options.from);
+        }
+        catch (const Poco::Exception &e)
+        {
+            std::cerr << "capture: " << e.displayText() << std::endl;
+            return 66;
+        }
+        if (first == std::numeric_limits<int64_t>::max())
+        {
+            std::cerr << "capture: no records" << std::endl;
+            return 66;
+        }
+    }
+
+    std::vector<PublisherResult> results(options.publishers);
+    std::vector<std::thread> publishers;
+    const Clock::time_point start = Clock::now() + std::chrono::milliseconds(options.warmup);
+    for (size_t i = 0; i < options.publishers; ++i)
+    {
+        publishers.emplace_back([&, i] {
+            try
+            {
+                if (options.source == "capture")
+                {
+                    runCapturePublisher(context, options, i, first, start, results[i]);
+                }
+                else
+                {
+                    runMonsterPublisher(context, options, i, start, results[i]);
+                }
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "publisher " << i << ": " << e.what() << std::endl;
+            }
+        });
+    }
+    for (std::thread &publisher : publishers)
+    {
+        publisher.join();
+    }
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    uint64_t sent = 0;
+    uint64_t bytes = 0;
+    LatencyHistogram::Snapshot lateness;
+    for (const PublisherResult &result : results)
+    {
+        sent += result.sent;
+        bytes += result.bytes;
+        result.lateness.addTo(lateness);
+    }
+    std::cout << "{\"source\":\"" << options.source << "\",\"publishers\":" << options.publishers
+              << ",\"sent\":" << sent << ",\"bytes\":" << bytes << ",\"seconds\":" << seconds
+              << ",\"msgs_per_sec\":" << (seconds > 0 ? static_cast<double>(sent) / seconds : 0.0)
+              << ",\"late_ns\":{\"p50\":" << lateness.percentile(0.5) << ",\"p99\":" << lateness.percentile(0.99)
+              << ",\"max\":" << lateness.max << "}}" << std::endl;
+    return 0;
+}
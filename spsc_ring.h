@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded single-producer/single-consumer ring. Slots are allocated once and
+// filled in place, so pushing never allocates and never blocks: when the ring
+// is full the producer is told so and decides what to drop.
+template <typename T> class SpscRing
+{
+  public:
+    // `capacity` is rounded up to a power of two.
+    explicit SpscRing(size_t capacity) : m_slots(roundUp(capacity)), m_mask(m_slots.size() - 1)
+    {
+    }
+
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    // Producer side. Calls `fill(T &)` on a free slot and publishes it;
+    // returns false without calling `fill` if the ring is full.
+    template <typename Fill> bool tryPush(Fill &&fill)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_cachedTail == m_slots.size())
+        {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (head - m_cachedTail == m_slots.size())
+            {
+                return false;
+            }
+        }
+
+        fill(m_slots[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Calls `consume(T &)` for up to `max` published slots and
+    // returns how many were consumed.
+    template <typename Consume> size_t drain(Consume &&consume, size_t max = static_cast<size_t>(-1))
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_cachedHead)
+        {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+        }
+
+        size_t count = m_cachedHead - tail;
+        if (count > max)
+        {
+            count = max;
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            consume(m_slots[(tail + i) & m_mask]);
+        }
+
+        m_tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    // Approximate; exact only when called from the consumer with the producer idle.
+    bool empty() const
+    {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const
+    {
+        return m_slots.size();
+    }
+
+  private:
+    static size_t roundUp(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    std::vector<T> m_slots;
+    const size_t m_mask;
+
+    // Producer and consumer indices live on separate cache lines, each next to
+    // the producer's/consumer's private copy of the other side's index.
+    alignas(64) std::atomic<size_t> m_head{0};
+    size_t m_cachedTail{0};
+    alignas(64) std::atomic<size_t> m_tail{0};
+    size_t m_cachedHead{0};
+};
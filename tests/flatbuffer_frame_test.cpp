@@ -0,0 +1,85 @@
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <flatbuffers/flatbuffers.h>
+#include <zmq.hpp>
+
+#include "flatbuffer_frame.h"
+#include "monster_generated.h"
+
+// FlatBufferView on frames at every offset from an 8-byte boundary, as
+// libzmq's TCP decoder hands them out, small enough to be copied into the
+// view and too large for that.
+
+namespace
+{
+
+int failures = 0;
+
+void check(bool condition, const char *what, size_t inventory, size_t offset)
+{
+    if (!condition)
+    {
+        std::cerr << "FAIL: " << what << " (inventory " << inventory << ", offset " << offset << ")" << std::endl;
+        ++failures;
+    }
+}
+
+flatbuffers::DetachedBuffer buildMonster(size_t inventory)
+{
+    flatbuffers::FlatBufferBuilder builder;
+    const std::vector<uint8_t> items(inventory, 7);
+    const auto name = builder.CreateString("Orc");
+    const auto bytes = builder.CreateVector(items);
+    MyGame::MonsterBuilder monster(builder);
+    monster.add_name(name);
+    monster.add_hp(300);
+    monster.add_inventory(bytes);
+    builder.Finish(monster.Finish());
+    return builder.Release();
+}
+
+void checkOffsets(size_t inventory)
+{
+    const flatbuffers::DetachedBuffer buffer = buildMonster(inventory);
+    // uint64_t storage, so offset 0 is 8-byte aligned.
+    std::vector<uint64_t> storage(buffer.size() / sizeof(uint64_t) + 2);
+    for (size_t offset = 0; offset < 8; ++offset)
+    {
+        uint8_t *data = reinterpret_cast<uint8_t *>(storage.data()) + offset;
+        std::memcpy(data, buffer.data(), buffer.size());
+        const zmq::message_t frame(data, buffer.size(), nullptr);
+
+        const FlatBufferView<MyGame::Monster> monster(frame);
+        check(static_cast<bool>(monster), "view is valid", inventory, offset);
+        check(monster.copied() == (offset != 0), "copied only when misaligned", inventory, offset);
+        if (monster)
+        {
+            check(monster->hp() == 300, "hp", inventory, offset);
+            check(monster->name() && monster->name()->str() == "Orc", "name", inventory, offset);
+            check(monster->inventory() && monster->inventory()->size() == inventory, "inventory", inventory, offset);
+        }
+
+        // A second view alive at the same time must not share the copy.
+        const FlatBufferView<MyGame::Monster> again(frame);
+        check(again && monster && (offset == 0 || again.get() != monster.get()) && again->hp() == 300, "nested view",
+              inventory, offset);
+    }
+}
+
+} // namespace
+
+int main()
+{
+    for (size_t inventory : {4, 200, 4000})
+    {
+        checkOffsets(inventory);
+    }
+    if (failures == 0)
+    {
+        std::cout << "flatbuffer_frame_test: ok" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,200 @@
+#include <cstdint>
+#include <iostream>
+#include <list>
+#include <string>
+#include <utility>
+
+#include <zmq.hpp>
+
+#include "last_value_cache.h"
+#include "message_source.h"
+#include "zmq_forwarder.h"
+
+// LastValueCache against a real XPUB over inproc: a replay reaches the new
+// subscriber only and leaves XPUB publishing to everybody afterwards; and
+// eviction by topic count and by bytes keeps every surviving topic findable.
+// Needs libzmq's draft ZMQ_XPUB_MANUAL_LAST_VALUE, skipped without it.
+
+namespace
+{
+
+// ctest reports the test as skipped, see SKIP_RETURN_CODE in CMakeLists.txt.
+constexpr int kSkipped = 77;
+
+#ifdef ZMQ_XPUB_MANUAL_LAST_VALUE
+
+int failures = 0;
+
+void check(bool condition, const std::string &what)
+{
+    if (!condition)
+    {
+        std::cerr << "FAIL: " << what << std::endl;
+        ++failures;
+    }
+}
+
+// What the broker does with a published message.
+bool publish(LastValueCache &cache, zmq::socket_t &xpub, Multipart &message)
+{
+    cache.stage(message);
+    if (!message.send(xpub, zmq::send_flags::dontwait))
+    {
+        return false;
+    }
+    cache.commit();
+    return true;
+}
+
+// What the broker does with the next subscription message.
+void handleSubscription(LastValueCache &cache, zmq::socket_t &xpub)
+{
+    zmq::message_t frame;
+    check(xpub.recv(frame).has_value(), "subscription reaches the broker");
+    cache.subscription(xpub, frame);
+}
+
+// Returns the payload, or an empty string after the receive timeout.
+std::string receive(zmq::socket_t &sub)
+{
+    zmq::message_t topic, payload;
+    if (!sub.recv(topic) || !topic.more() || !sub.recv(payload))
+    {
+        return {};
+    }
+    return payload.to_string();
+}
+
+zmq::socket_t subscriber(zmq::context_t &context, const std::string &topic)
+{
+    zmq::socket_t sub(context, ZMQ_SUB);
+    sub.set(zmq::sockopt::rcvtimeo, 1000);
+    sub.connect("inproc://lvc-test-xpub");
+    sub.set(zmq::sockopt::subscribe, topic);
+    return sub;
+}
+
+void checkReplayIsPrivate()
+{
+    zmq::context_t context;
+    MessageSource source(context);
+    LastValueSettings settings;
+    settings.enabled = true;
+    LastValueCache cache(settings);
+    zmq::socket_t xpub(context, ZMQ_XPUB);
+    xpub.set(zmq::sockopt::rcvtimeo, 1000);
+    cache.prepare(xpub);
+    xpub.bind("inproc://lvc-test-xpub");
+
+    check(publish(cache, xpub, source.make({"a", "1"})), "publish before anybody subscribed");
+    check(cache.contains("a"), "published topic is cached");
+
+    zmq::socket_t a = subscriber(context, "a");
+    handleSubscription(cache, xpub);
+    check(receive(a) == "1", "new subscriber gets the cached message");
+    check(cache.replayed() == 1, "replay counted");
+
+    // Not cached, so not answered: XPUB must not stay aimed at b's pipe.
+    zmq::socket_t b = subscriber(context, "b");
+    handleSubscription(cache, xpub);
+
+    check(publish(cache, xpub, source.make({"a", "2"})), "publish after the replay");
+    check(receive(a) == "2", "earlier subscriber still gets new messages");
+    check(publish(cache, xpub, source.make({"b", "3"})), "publish to the second subscriber");
+    check(receive(b) == "3", "second subscriber gets its topic");
+}
+
+// Mirrors the cache's least-recently-updated order and byte count.
+struct Model
+{
+    std::list<std::pair<std::string, size_t>> topics;
+    size_t bytes = 0;
+
+    void update(const std::string &topic, size_t size, const LastValueSettings &settings)
+    {
+        for (auto it = topics.begin(); it != topics.end(); ++it)
+        {
+            if (it->first == topic)
+            {
+                bytes -= it->second;
+                topics.erase(it);
+                break;
+            }
+        }
+        topics.emplace_back(topic, size);
+        bytes += size;
+        while (!topics.empty() && (topics.size() > settings.maxTopics || bytes > settings.maxBytes))
+        {
+            bytes -= topics.front().second;
+            topics.pop_front();
+        }
+    }
+};
+
+void checkEviction(size_t maxTopics, size_t maxBytes)
+{
+    const std::string limits = " (max_topics " + std::to_string(maxTopics) + ", max_bytes " +
+                               std::to_string(maxBytes) + ")";
+    zmq::context_t context;
+    MessageSource source(context);
+    LastValueSettings settings;
+    settings.enabled = true;
+    settings.maxTopics = maxTopics;
+    settings.maxBytes = maxBytes;
+    LastValueCache cache(settings);
+    Model model;
+
+    // 200 distinct topics, every seventh update revisits an older one, so
+    // entries are evicted, moved into holes and relinked all along.
+    for (size_t i = 0; i < 600; ++i)
+    {
+        const std::string topic = "t/" + std::to_string(i % 7 == 0 ? i / 7 : i % 200);
+        const std::string payload(i % 37 * 3, 'x');
+        cache.stage(source.make({topic, payload}));
+        cache.commit();
+        model.update(topic, topic.size() + payload.size(), settings);
+
+        if (i % 50 == 49 || i == 599)
+        {
+            check(cache.topics() == model.topics.size(), "topic count after " + std::to_string(i) + limits);
+            check(cache.bytes() == model.bytes, "byte count after " + std::to_string(i) + limits);
+            for (const auto &[name, size] : model.topics)
+            {
+                check(cache.contains(name), "survivor " + name + " found after " + std::to_string(i) + limits);
+            }
+        }
+    }
+    for (size_t t = 0; t < 200; ++t)
+    {
+        const std::string name = "t/" + std::to_string(t);
+        bool kept = false;
+        for (const auto &entry : model.topics)
+        {
+            kept = kept || entry.first == name;
+        }
+        check(cache.contains(name) == kept, "evicted " + name + " not found" + limits);
+    }
+    check(cache.evicted() != 0, "something was evicted" + limits);
+}
+
+#endif
+
+} // namespace
+
+int main()
+{
+#ifdef ZMQ_XPUB_MANUAL_LAST_VALUE
+    checkReplayIsPrivate();
+    checkEviction(8, size_t(64) << 20);
+    checkEviction(65536, 600);
+    checkEviction(13, 900);
+    if (failures == 0)
+    {
+        std::cout << "last_value_cache_test: ok" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+#else
+    std::cout << "last_value_cache_test: skipped, libzmq lacks ZMQ_XPUB_MANUAL_LAST_VALUE" << std::endl;
+    return kSkipped;
+#endif
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <initializer_list>
+#include <string>
+
+#include <zmq.hpp>
+
+#include "zmq_forwarder.h"
+
+// Builds Multiparts the way the broker gets them, by receiving them over an
+// inproc PAIR. The returned message is reused by the next make().
+class MessageSource
+{
+  public:
+    explicit MessageSource(zmq::context_t &context, const std::string &endpoint = "inproc://test-source")
+        : m_out(context, ZMQ_PAIR), m_in(context, ZMQ_PAIR), m_message{}
+    {
+        m_in.bind(endpoint);
+        m_out.connect(endpoint);
+    }
+
+    Multipart &make(std::initializer_list<std::string> frames)
+    {
+        size_t left = frames.size();
+        for (const std::string &frame : frames)
+        {
+            m_out.send(zmq::buffer(frame), --left ? zmq::send_flags::sndmore : zmq::send_flags::none);
+        }
+        m_message.recv(m_in);
+        return m_message;
+    }
+
+  private:
+    zmq::socket_t m_out;
+    zmq::socket_t m_in;
+    Multipart m_message;
+};
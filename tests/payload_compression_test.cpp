@@ -0,0 +1,177 @@
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <zmq.hpp>
+
+#include "broker_metrics.h"
+#include "message_source.h"
+#include "payload_compression.h"
+#include "zmq_forwarder.h"
+
+// PayloadCompressor followed by decompressMessage(): payloads come back as
+// published whether they were compressed, too small, compressed poorly or
+// skipped by the backoff, including payloads that start like the header;
+// and topics that are not compressed are left alone. Needs LZ4.
+
+namespace
+{
+
+// ctest reports the test as skipped, see SKIP_RETURN_CODE in CMakeLists.txt.
+constexpr int kSkipped = 77;
+
+#ifdef POCOEX_HAVE_LZ4
+
+int failures = 0;
+
+void check(bool condition, const std::string &what)
+{
+    if (!condition)
+    {
+        std::cerr << "FAIL: " << what << std::endl;
+        ++failures;
+    }
+}
+
+std::string noise(size_t size, std::mt19937 &random)
+{
+    std::string bytes(size, '\0');
+    for (char &c : bytes)
+    {
+        c = static_cast<char>(random());
+    }
+    return bytes;
+}
+
+std::vector<std::string> frames(const Multipart &message)
+{
+    std::vector<std::string> frames;
+    for (size_t i = 0; i < message.size(); ++i)
+    {
+        frames.push_back(message[i].to_string());
+    }
+    return frames;
+}
+
+struct Fixture
+{
+    Fixture() : context{}, source(context), settings{}, metrics(16), compressor(make(settings, metrics))
+    {
+    }
+
+    static PayloadCompressor make(CompressSettings &settings, BrokerMetrics &metrics)
+    {
+        settings.enabled = true;
+        settings.topics = {"a", "r"};
+        settings.minBytes = 1024;
+        settings.maxRatio = 0.9;
+        return PayloadCompressor(settings, "tcp://127.0.0.1:5556", metrics, false);
+    }
+
+    // Compresses and decompresses `sent`; returns the header's sizes.
+    std::vector<uint32_t> roundTrip(std::initializer_list<std::string> sent, const std::string &what)
+    {
+        const std::vector<std::string> expected(sent);
+        Multipart &message = source.make(sent);
+        compressor.compress(message);
+        std::vector<uint32_t> sizes;
+        check(message.size() == expected.size() + 1, what + ": header inserted");
+        if (message.size() == expected.size() + 1 && CompressionHeader::is(message[1], expected.size() - 1))
+        {
+            for (size_t i = 0; i + 1 < expected.size(); ++i)
+            {
+                sizes.push_back(CompressionHeader::originalSize(message[1], i));
+            }
+        }
+        check(decompressMessage(message), what + ": decompresses");
+        check(frames(message) == expected, what + ": frames as published");
+        return sizes;
+    }
+
+    zmq::context_t context;
+    MessageSource source;
+    CompressSettings settings;
+    BrokerMetrics metrics;
+    PayloadCompressor compressor;
+};
+
+void checkRoundTrip()
+{
+    Fixture fixture;
+    std::mt19937 random(1);
+    const std::string stamp(8, '\x11');
+    const std::string zeros(16384, '\0');
+
+    const std::vector<uint32_t> sizes = fixture.roundTrip({"a", stamp, zeros}, "compressible");
+    check(sizes == std::vector<uint32_t>{0, 16384}, "only the large frame is compressed");
+    check(fixture.metrics.compressed.load() == 1, "compressed counted");
+
+    // Looks like the header, and like the old in-band marker.
+    const std::string lookalike = std::string("PLZ4") + std::string("\x10\0\0\0", 4) + "payload";
+    check(fixture.roundTrip({"a", lookalike}, "lookalike payload") == std::vector<uint32_t>{0},
+          "lookalike sent as it is");
+    const uint32_t large = static_cast<uint32_t>(lookalike.size() + zeros.size());
+    check(fixture.roundTrip({"a", lookalike + zeros}, "large lookalike") == std::vector<uint32_t>{large},
+          "large lookalike compressed");
+
+    const uint64_t skipped = fixture.metrics.compressSkipped.load();
+    check(fixture.roundTrip({"a", noise(4096, random)}, "incompressible") == std::vector<uint32_t>{0},
+          "poor ratio sent as it is");
+    check(fixture.metrics.compressSkipped.load() == skipped + 1, "poor ratio counted");
+}
+
+void checkBackoff()
+{
+    Fixture fixture;
+    std::mt19937 random(2);
+    // After n poor results in a row the next 2^n frames are not tried.
+    const std::vector<uint64_t> tried = {1, 1, 1, 2, 2, 2, 2, 2, 3};
+    for (size_t i = 0; i < tried.size(); ++i)
+    {
+        fixture.roundTrip({"r", noise(2048, random)}, "backoff " + std::to_string(i));
+        check(fixture.metrics.compressSkipped.load() == tried[i], "attempts after frame " + std::to_string(i));
+    }
+    // Skipped frames still come back intact, and a frame that compresses
+    // well ends the backoff once it is tried.
+    for (size_t i = 0; i < 16; ++i)
+    {
+        fixture.roundTrip({"r", std::string(2048, 'z')}, "recovery " + std::to_string(i));
+    }
+    check(fixture.metrics.compressed.load() != 0, "compression resumes");
+    const uint64_t compressed = fixture.metrics.compressed.load();
+    fixture.roundTrip({"r", std::string(2048, 'z')}, "after recovery");
+    check(fixture.metrics.compressed.load() == compressed + 1, "no backoff after a good result");
+}
+
+void checkOtherTopics()
+{
+    Fixture fixture;
+    const std::string lookalike = std::string("PLZ4") + std::string(4, '\0') + std::string(4096, '\0');
+    Multipart &message = fixture.source.make({"z", lookalike});
+    fixture.compressor.compress(message);
+    check(frames(message) == std::vector<std::string>{"z", lookalike}, "unselected topic untouched");
+    check(!decompressMessage(message), "no header, not decompressed");
+}
+
+#endif
+
+} // namespace
+
+int main()
+{
+#ifdef POCOEX_HAVE_LZ4
+    checkRoundTrip();
+    checkBackoff();
+    checkOtherTopics();
+    if (failures == 0)
+    {
+        std::cout << "payload_compression_test: ok" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+#else
+    std::cout << "payload_compression_test: skipped, built without LZ4" << std::endl;
+    return kSkipped;
+#endif
+}
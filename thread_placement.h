@@ -0,0 +1,292 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "Poco/DirectoryIterator.h"
+#include "Poco/Environment.h"
+#include "Poco/Error.h"
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+#include "Poco/Logger.h"
+#include "Poco/StringTokenizer.h"
+#include "Poco/Thread.h"
+#include "Poco/Util/AbstractConfiguration.h"
+#include "Poco/Util/Application.h"
+#include "Poco/Util/Subsystem.h"
+
+struct PlacementSettings
+{
+    bool enabled = false;
+    // CPU lists by thread name, from placement.threads.<name>.
+    std::map<std::string, std::vector<int>> threads;
+
+    // A list as taskset -c takes it: "2", "2-5" or "1,3,8-9". Every CPU must
+    // be below the number of online CPUs.
+    static std::vector<int> parseCpus(const std::string &key, const std::string &list)
+    {
+        long limit = static_cast<long>(std::max(1u, Poco::Environment::processorCount()));
+#if defined(__linux__)
+        limit = std::min<long>(limit, CPU_SETSIZE);
+#endif
+        std::vector<int> cpus;
+        Poco::StringTokenizer ranges(list, ",",
+                                     Poco::StringTokenizer::TOK_TRIM | Poco::StringTokenizer::TOK_IGNORE_EMPTY);
+        for (const std::string &range : ranges)
+        {
+            char *end = nullptr;
+            const long first = std::strtol(range.c_str(), &end, 10);
+            long last = first;
+            if (*end == '-')
+            {
+                last = std::strtol(end + 1, &end, 10);
+            }
+            if (end == range.c_str() || *end != '\0' || first < 0 || last < first)
+            {
+                throw Poco::InvalidArgumentException(key, list);
+            }
+            if (last >= limit)
+            {
+                const std::string online = "0-" + std::to_string(limit - 1);
+                throw Poco::InvalidArgumentException(key, list + " (online CPUs are " + online + ")");
+            }
+            for (long cpu = first; cpu <= last; ++cpu)
+            {
+                cpus.push_back(static_cast<int>(cpu));
+            }
+        }
+        return cpus;
+    }
+
+    static PlacementSettings fromConfig(const Poco::Util::AbstractConfiguration &config)
+    {
+        PlacementSettings settings;
+        settings.enabled = config.getBool("placement.enable", settings.enabled);
+        Poco::Util::AbstractConfiguration::Keys names;
+        config.keys("placement.threads", names);
+        for (const std::string &name : names)
+        {
+            const std::string key = "placement.threads." + name;
+            settings.threads[name] = parseCpus(key, config.getString(key));
+        }
+        return settings;
+    }
+};
+
+// Pins threads to CPUs by name. Every long-lived thread calls apply() as it
+// starts; a name with its own entry (broker, async-log) gets that CPU set,
+// while a numbered thread of a family (shard-2, consumer-5) with an entry
+// for the family only gets one CPU of it, the index-th modulo its size. A
+// thread without an entry is left alone, as is everything before
+// configure().
+//
+// Placement is also what keeps allocations NUMA-local: Linux places a page
+// on the node of the CPU that first touches it, so buffers a pinned thread
+// fills itself stay on its node. A CPU set that spans nodes is reported.
+class ThreadPlacement
+{
+  public:
+    static void configure(const PlacementSettings &settings, Poco::Logger &logger)
+    {
+        State &state = instance();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.settings = settings;
+        state.logger = &logger;
+    }
+
+    // CPUs the thread called `name` goes on, none if it is not placed.
+    static std::vector<int> cpus(const std::string &name)
+    {
+        State &state = instance();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (!state.settings.enabled)
+        {
+            return {};
+        }
+        const auto exact = state.settings.threads.find(name);
+        if (exact != state.settings.threads.end())
+        {
+            return exact->second;
+        }
+        const size_t dash = name.rfind('-');
+        if (dash == std::string::npos || dash + 1 == name.size() ||
+            name.find_first_not_of("0123456789", dash + 1) != std::string::npos)
+        {
+            return {};
+        }
+        const auto family = state.settings.threads.find(name.substr(0, dash));
+        if (family == state.settings.threads.end() || family->second.empty())
+        {
+            return {};
+        }
+        const size_t index = std::strtoul(name.c_str() + dash + 1, nullptr, 10);
+        return {family->second[index % family->second.size()]};
+    }
+
+    // Pins the calling thread, named after its Poco::Thread.
+    static bool apply()
+    {
+        const Poco::Thread *thread = Poco::Thread::current();
+        return thread && apply(thread->getName());
+    }
+
+    static bool apply(const std::string &name)
+    {
+        const std::vector<int> set = cpus(name);
+        if (set.empty())
+        {
+            return false;
+        }
+        State &state = instance();
+#if defined(__linux__)
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        for (int cpu : set)
+        {
+            CPU_SET(cpu, &mask);
+        }
+        const int error = pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+        if (error != 0)
+        {
+            state.logger->warning("placement: cannot pin " + name + " to CPUs " + format(set) + ": " +
+                                  Poco::Error::getMessage(error));
+            return false;
+        }
+        const std::vector<int> nodes = nodesOf(set);
+        state.logger->information("placement: " + name + " on CPUs " + format(set) +
+                                  (nodes.empty() ? "" : ", NUMA node " + format(nodes)) +
+                                  (nodes.size() > 1 ? " (spans nodes, allocations may be remote)" : ""));
+        return true;
+#else
+        state.logger->warning("placement: thread affinity is not supported on this platform, " + name +
+                              " is not pinned");
+        return false;
+#endif
+    }
+
+    static std::string format(const std::vector<int> &values)
+    {
+        std::string text;
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+            text += (i ? "," : "") + std::to_string(values[i]);
+        }
+        return text;
+    }
+
+  private:
+    struct State
+    {
+        std::mutex mutex;
+        PlacementSettings settings;
+        Poco::Logger *logger = nullptr;
+    };
+
+    static State &instance()
+    {
+        static State state;
+        return state;
+    }
+
+    // NUMA nodes of `cpus`, from sysfs; empty where that is not available.
+    static std::vector<int> nodesOf(const std::vector<int> &cpus)
+    {
+        std::vector<int> nodes;
+        for (int cpu : cpus)
+        {
+            const std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+            if (!Poco::File(path).exists())
+            {
+                continue;
+            }
+            for (Poco::DirectoryIterator it(path), end; it != end; ++it)
+            {
+                if (it.name().rfind("node", 0) == 0 && it.name().size() > 4)
+                {
+                    const int node = std::atoi(it.name().c_str() + 4);
+                    if (std::find(nodes.begin(), nodes.end(), node) == nodes.end())
+                    {
+                        nodes.push_back(node);
+                    }
+                }
+            }
+        }
+        std::sort(nodes.begin(), nodes.end());
+        return nodes;
+    }
+};
+
+// Pins the calling thread as `name` for its lifetime, then gives the thread
+// back the affinity it had. For work running on a thread it does not own,
+// such as a task on a TaskManager pool thread, which later runs other tasks.
+class ScopedPlacement
+{
+  public:
+    explicit ScopedPlacement(const std::string &name) : m_pinned(false)
+    {
+#if defined(__linux__)
+        CPU_ZERO(&m_previous);
+        m_pinned = pthread_getaffinity_np(pthread_self(), sizeof(m_previous), &m_previous) == 0 &&
+                   ThreadPlacement::apply(name);
+#else
+        ThreadPlacement::apply(name);
+#endif
+    }
+
+    ~ScopedPlacement()
+    {
+#if defined(__linux__)
+        if (m_pinned)
+        {
+            pthread_setaffinity_np(pthread_self(), sizeof(m_previous), &m_previous);
+        }
+#endif
+    }
+
+    ScopedPlacement(const ScopedPlacement &) = delete;
+    ScopedPlacement &operator=(const ScopedPlacement &) = delete;
+
+  private:
+    bool m_pinned;
+#if defined(__linux__)
+    cpu_set_t m_previous;
+#endif
+};
+
+// Reads [placement] and reports it. Added before the subsystems whose
+// threads it places, so it is configured before any of them starts one.
+class PlacementSubsystem : public Poco::Util::Subsystem
+{
+  public:
+    const char *name() const override
+    {
+        return "PlacementSubsystem";
+    }
+
+    void initialize(Poco::Util::Application &app) override
+    {
+        const PlacementSettings settings = PlacementSettings::fromConfig(app.config());
+        ThreadPlacement::configure(settings, app.logger());
+        if (!settings.enabled)
+        {
+            return;
+        }
+        for (const auto &[name, cpus] : settings.threads)
+        {
+            app.logger().information("placement: " + name + " -> CPUs " + ThreadPlacement::format(cpus));
+        }
+    }
+
+    void uninitialize() override
+    {
+    }
+};
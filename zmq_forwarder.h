@@ -0,0 +1,393 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <zmq.hpp>
+
+// One multipart ZMQ message. Frames are received in place and handed to the
+// outgoing socket by ownership transfer (zmq_msg_send), so payloads are never
+// copied. The frame storage is reused between messages; after warm-up neither
+// recv() nor send() allocates.
+class Multipart
+{
+  public:
+    Multipart() : m_frames{}, m_count{0}, m_bytes{0}, m_stamp{0}
+    {
+        m_frames.resize(4);
+    }
+
+    // Receives every frame of the next message. Only the first frame honours
+    // `flags`: ZMQ delivers multipart messages atomically, so once it has
+    // arrived the remaining frames are already queued.
+    bool recv(zmq::socket_t &socket, zmq::recv_flags flags = zmq::recv_flags::none)
+    {
+        m_count = 0;
+        m_bytes = 0;
+
+        if (!socket.recv(frame(0), flags))
+        {
+            return false;
+        }
+
+        do
+        {
+            m_bytes += m_frames[m_count].size();
+            if (!m_frames[m_count++].more())
+            {
+                break;
+            }
+        } while (socket.recv(frame(m_count), zmq::recv_flags::none));
+
+        return true;
+    }
+
+    // Sends all frames, moving their content into the socket. Returns false
+    // without touching the frames if the first frame would block under
+    // `send_flags::dontwait`.
+    bool send(zmq::socket_t &socket, zmq::send_flags flags = zmq::send_flags::none)
+    {
+        for (size_t i = 0; i < m_count; ++i)
+        {
+            const bool last = i + 1 == m_count;
+            zmq::send_flags partFlags = last ? flags : (flags | zmq::send_flags::sndmore);
+            if (!socket.send(m_frames[i], partFlags))
+            {
+                // Only the first part can be refused; the rest of a multipart
+                // message is always accepted once it has started.
+                return false;
+            }
+        }
+
+        m_count = 0;
+        m_bytes = 0;
+        return true;
+    }
+
+    size_t size() const
+    {
+        return m_count;
+    }
+
+    bool empty() const
+    {
+        return m_count == 0;
+    }
+
+    size_t bytes() const
+    {
+        return m_bytes;
+    }
+
+    zmq::message_t &operator[](size_t index)
+    {
+        return m_frames[index];
+    }
+
+    const zmq::message_t &operator[](size_t index) const
+    {
+        return m_frames[index];
+    }
+
+    const zmq::message_t &front() const
+    {
+        return m_frames[0];
+    }
+
+    const zmq::message_t &back() const
+    {
+        return m_frames[m_count - 1];
+    }
+
+    // Puts a copy of `size` bytes at `data` in as frame `index`, moving the
+    // later frames up. A frame of up to 33 bytes does not allocate.
+    void insert(size_t index, const void *data, size_t size)
+    {
+        frame(m_count).rebuild(data, size);
+        std::rotate(m_frames.begin() + index, m_frames.begin() + m_count, m_frames.begin() + m_count + 1);
+        ++m_count;
+        m_bytes += size;
+    }
+
+    // Removes frame `index`, moving the later frames down.
+    void erase(size_t index)
+    {
+        m_bytes -= m_frames[index].size();
+        std::rotate(m_frames.begin() + index, m_frames.begin() + index + 1, m_frames.begin() + m_count);
+        m_frames[--m_count].rebuild();
+    }
+
+    // Arrival time of the message on the broker, in monotonic nanoseconds.
+    uint64_t stamp() const
+    {
+        return m_stamp;
+    }
+
+    void setStamp(uint64_t stamp)
+    {
+        m_stamp = stamp;
+    }
+
+    // Carries the stamp across an internal hop as an extra trailing frame.
+    // Eight bytes fit in zmq_msg_t itself, so this does not allocate.
+    void pushStamp()
+    {
+        frame(m_count++).rebuild(&m_stamp, sizeof(m_stamp));
+    }
+
+    void popStamp()
+    {
+        if (m_count > 1 && m_frames[m_count - 1].size() == sizeof(m_stamp))
+        {
+            std::memcpy(&m_stamp, m_frames[--m_count].data(), sizeof(m_stamp));
+        }
+    }
+
+  private:
+    zmq::message_t &frame(size_t index)
+    {
+        if (index == m_frames.size())
+        {
+            m_frames.resize(m_frames.size() * 2);
+        }
+        return m_frames[index];
+    }
+
+    std::vector<zmq::message_t> m_frames;
+    size_t m_count;
+    size_t m_bytes;
+    uint64_t m_stamp;
+};
+
+// FNV-1a over the topic frame. Stable across runs and platforms, so a topic
+// always lands on the same shard.
+inline uint64_t topicHash(std::string_view topic)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (const char c : topic)
+    {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+inline uint64_t topicHash(const zmq::message_t &topic)
+{
+    return topicHash(std::string_view(static_cast<const char *>(topic.data()), topic.size()));
+}
+
+// Sends `command` to the PAIR socket bound at `endpoint`, from whichever thread
+// calls it. Used to wake a thread blocked in zmq::poll without any timeout.
+inline void signalEndpoint(zmq::context_t &context, const std::string &endpoint, std::string_view command)
+{
+    // Default linger: the command must survive closing this socket straight away.
+    zmq::socket_t signal(context, ZMQ_PAIR);
+    signal.connect(endpoint);
+    signal.send(zmq::buffer(command), zmq::send_flags::none);
+}
+
+// Moves whole messages from one socket to another, whatever their frame count,
+// and keeps running totals for throughput reporting.
+class ZmqForwarder
+{
+  public:
+    // With `send_flags::dontwait` a message the destination cannot take is
+    // dropped and counted as refused instead of blocking.
+    ZmqForwarder(zmq::socket_t &from, zmq::socket_t &to, zmq::send_flags flags = zmq::send_flags::none)
+        : m_from(from), m_to(to), m_flags(flags), m_sender{}, m_message{}, m_messages{0}, m_frames{0}, m_bytes{0},
+          m_filtered{0}, m_refused{0}
+    {
+    }
+
+    // Forwards one message, first passing it to `bool inspect(Multipart &)`;
+    // a message the inspector returns false for is consumed but not sent.
+    // Returns false if nothing arrived (receive timeout or dontwait).
+    template <typename Inspect> bool forwardOne(Inspect &&inspect, zmq::recv_flags flags = zmq::recv_flags::none)
+    {
+        if (!m_message.recv(m_from, flags))
+        {
+            return false;
+        }
+
+        if (!inspect(m_message))
+        {
+            ++m_filtered;
+            return true;
+        }
+
+        ++m_messages;
+        m_frames += m_message.size();
+        m_bytes += m_message.bytes();
+
+        if (!(m_sender ? m_sender(m_message) : m_message.send(m_to, m_flags)))
+        {
+            ++m_refused;
+        }
+        return true;
+    }
+
+    // Replaces the plain send to the destination, e.g. with one that holds
+    // refused messages back; `send` returns false for a message it dropped.
+    void setSender(std::function<bool(Multipart &)> send)
+    {
+        m_sender = std::move(send);
+    }
+
+    bool forwardOne(zmq::recv_flags flags = zmq::recv_flags::none)
+    {
+        return forwardOne([](Multipart &) { return true; }, flags);
+    }
+
+    uint64_t messages() const
+    {
+        return m_messages;
+    }
+
+    uint64_t frames() const
+    {
+        return m_frames;
+    }
+
+    uint64_t bytes() const
+    {
+        return m_bytes;
+    }
+
+    // Messages the inspector declined to forward.
+    uint64_t filtered() const
+    {
+        return m_filtered;
+    }
+
+    // Messages dropped because the destination would have blocked.
+    uint64_t refused() const
+    {
+        return m_refused;
+    }
+
+  private:
+    zmq::socket_t &m_from;
+    zmq::socket_t &m_to;
+    zmq::send_flags m_flags;
+    std::function<bool(Multipart &)> m_sender;
+    Multipart m_message;
+    uint64_t m_messages;
+    uint64_t m_frames;
+    uint64_t m_bytes;
+    uint64_t m_filtered;
+    uint64_t m_refused;
+};
+
+// Poll-driven XSUB/XPUB proxy. Published messages flow frontend -> backend;
+// subscribe/unsubscribe frames flow backend -> frontend so that publishers only
+// send topics somebody downstream actually wants. An optional control socket
+// is polled alongside; any message on it ends the current poll() and marks
+// the proxy as interrupted.
+class ZmqProxy
+{
+  public:
+    // Upper bound on messages moved per socket per wakeup, so that a busy
+    // direction cannot starve the other one.
+    static constexpr size_t kBatch = 256;
+
+    // `flags` applies to sends on the backend, see ZmqForwarder.
+    ZmqProxy(zmq::socket_t &frontend, zmq::socket_t &backend, zmq::socket_t *control = nullptr,
+             zmq::send_flags flags = zmq::send_flags::none)
+        : m_frontend(frontend), m_backend(backend), m_control(control), m_interrupted(false),
+          m_downstream(frontend, backend, flags), m_upstream(backend, frontend)
+    {
+    }
+
+    // Waits up to `timeout` (forever by default) for traffic and forwards
+    // whatever is ready, passing each published message to
+    // `bool inspect(Multipart &)` and each subscription message to
+    // `bool inspectUpstream(Multipart &)`. Returns the number of messages
+    // moved in either direction.
+    template <typename Inspect, typename InspectUpstream>
+    size_t poll(Inspect &&inspect, InspectUpstream &&inspectUpstream,
+                std::chrono::milliseconds timeout = std::chrono::milliseconds(-1))
+    {
+        zmq::pollitem_t items[] = {{m_frontend.handle(), 0, ZMQ_POLLIN, 0},
+                                   {m_backend.handle(), 0, ZMQ_POLLIN, 0},
+                                   {m_control ? m_control->handle() : nullptr, 0, ZMQ_POLLIN, 0}};
+        if (zmq::poll(items, m_control ? 3 : 2, timeout) <= 0)
+        {
+            return 0;
+        }
+
+        if (items[2].revents & ZMQ_POLLIN)
+        {
+            // Any command stops the proxy, whatever it says.
+            zmq::message_t command;
+            (void)m_control->recv(command, zmq::recv_flags::dontwait);
+            m_interrupted = true;
+            return 0;
+        }
+
+        size_t moved = 0;
+        if (items[1].revents & ZMQ_POLLIN)
+        {
+            for (size_t i = 0; i < kBatch && m_upstream.forwardOne(inspectUpstream, zmq::recv_flags::dontwait); ++i)
+            {
+                ++moved;
+            }
+        }
+        if (items[0].revents & ZMQ_POLLIN)
+        {
+            for (size_t i = 0; i < kBatch && m_downstream.forwardOne(inspect, zmq::recv_flags::dontwait); ++i)
+            {
+                ++moved;
+            }
+        }
+        return moved;
+    }
+
+    template <typename Inspect>
+    size_t poll(Inspect &&inspect, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1))
+    {
+        return poll(inspect, [](Multipart &) { return true; }, timeout);
+    }
+
+    size_t poll(std::chrono::milliseconds timeout = std::chrono::milliseconds(-1))
+    {
+        return poll([](Multipart &) { return true; }, timeout);
+    }
+
+    bool interrupted() const
+    {
+        return m_interrupted;
+    }
+
+    // See ZmqForwarder::setSender(); applies to published messages.
+    void setSender(std::function<bool(Multipart &)> send)
+    {
+        m_downstream.setSender(std::move(send));
+    }
+
+    // Published traffic, frontend -> backend.
+    const ZmqForwarder &downstream() const
+    {
+        return m_downstream;
+    }
+
+    // Subscription traffic, backend -> frontend.
+    const ZmqForwarder &upstream() const
+    {
+        return m_upstream;
+    }
+
+  private:
+    zmq::socket_t &m_frontend;
+    zmq::socket_t &m_backend;
+    zmq::socket_t *m_control;
+    bool m_interrupted;
+    ZmqForwarder m_downstream;
+    ZmqForwarder m_upstream;
+};